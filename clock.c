@@ -1,6 +1,6 @@
 /* 
  * clock.c - Routines for using the cycle counters on x86, 
- *           Alpha, and Sparc boxes.
+ *           Alpha, and Sparc boxes, or rdtscp and the monotonic clock.
  * 
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
@@ -9,9 +9,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/times.h>
 #include "clock.h"
 
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+/* The raw clock is not slewed by NTP; fall back on the plain one */
+#ifdef CLOCK_MONOTONIC_RAW
+#define MONOTONIC_CLOCK CLOCK_MONOTONIC_RAW
+#else
+#define MONOTONIC_CLOCK CLOCK_MONOTONIC
+#endif
+
+#define CALIBRATION_NS 20000000  /* busy wait of one TSC calibration (20 ms) */
+#define CALIBRATIONS 3           /* the median of them is kept */
+
 
 /******************************************************* 
  * Machine dependent functions 
@@ -21,7 +36,7 @@
  * You can verify this for yourself using gcc -v.
  *******************************************************/
 
-#if defined(__i386__)  
+#if defined(__i386__) || defined(__x86_64__)
 /*******************************************************
  * Pentium versions of start_counter() and get_counter()
  *******************************************************/
@@ -71,6 +86,34 @@ double get_counter()
 }
 /* $end x86cyclecounter */
 
+/* 
+ * read_tscp - the time stamp counter, read with rdtscp: unlike rdtsc,
+ *     it waits for the instructions before it to complete
+ */
+static unsigned long long read_tscp(void)
+{
+    unsigned hi, lo, aux;
+
+    asm volatile("rdtscp" : "=a" (lo), "=d" (hi), "=c" (aux));
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+/* has_rdtscp - does the processor implement rdtscp? */
+static int has_rdtscp(void)
+{
+    unsigned eax, ebx, ecx, edx;
+
+    return __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) && (edx & (1 << 27));
+}
+
+/* has_invariant_tsc - does the TSC tick at a constant rate, in all states? */
+static int has_invariant_tsc(void)
+{
+    unsigned eax, ebx, ecx, edx;
+
+    return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1 << 8));
+}
+
 #elif defined(__alpha)
 
 /****************************************************
@@ -166,6 +209,61 @@ double get_counter()
 /*******************************
  * Machine-independent functions
  ******************************/
+
+/* read_monotonic - nanoseconds of the monotonic clock */
+static unsigned long long read_monotonic(void)
+{
+    struct timespec ts;
+
+    clock_gettime(MONOTONIC_CLOCK, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* 
+ * counter_available - Can read_counter read this source here?
+ */
+int counter_available(int source)
+{
+    switch (source) {
+    case COUNTER_MONOTONIC:
+	return 1;
+    case COUNTER_CYCLES:
+#if defined(__i386__) || defined(__x86_64__) || defined(__alpha)
+	return 1;
+#else
+	return 0;
+#endif
+    case COUNTER_RDTSCP:
+#if defined(__i386__) || defined(__x86_64__)
+	return has_rdtscp();
+#endif
+    default:
+	return 0;
+    }
+}
+
+/* 
+ * read_counter - The current count of a source. Unlike start_counter
+ *     and get_counter, it keeps no state: the caller subtracts.
+ */
+unsigned long long read_counter(int source)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned hi, lo;
+
+    if (source == COUNTER_CYCLES) {
+	access_counter(&hi, &lo);
+	return ((unsigned long long)hi << 32) | lo;
+    }
+    if (source == COUNTER_RDTSCP)
+	return read_tscp();
+#elif defined(__alpha)
+    if (source == COUNTER_CYCLES)
+	return counter();
+#endif
+    return read_monotonic();
+}
+
 double ovhd()
 {
     /* Do it twice to eliminate cache effects */
@@ -201,6 +299,51 @@ double mhz(int verbose)
     return mhz_full(verbose, 2);
 }
 
+/*
+ * counter_mhz - Rate of a source, in counts per microsecond. The
+ *     time stamp counter is timed against the monotonic clock, over a
+ *     busy wait rather than a sleep: the median of a few short waits is
+ *     accurate to well under 0.1% and takes a fraction of a second.
+ */
+double counter_mhz(int source, int verbose)
+{
+    double rates[CALIBRATIONS], rate, counts;
+    unsigned long long ns0, ns1, c0;
+    int i, j;
+
+    if (source == COUNTER_MONOTONIC) {
+	if (verbose)
+	    printf("Counting nanoseconds of the monotonic clock\n");
+	return 1000.0;
+    }
+
+    for (i = 0; i < CALIBRATIONS; i++) {
+	ns0 = read_monotonic();
+	c0 = read_counter(source);
+	do 
+	    ns1 = read_monotonic();
+	while (ns1 - ns0 < CALIBRATION_NS);
+	counts = (double)(read_counter(source) - c0);
+	rates[i] = counts / ((ns1 - ns0) / 1e3);
+	/* Insertion sort */
+	for (j = i; j > 0 && rates[j-1] > rates[j]; j--) {
+	    rate = rates[j-1];
+	    rates[j-1] = rates[j];
+	    rates[j] = rate;
+	}
+    }
+    rate = rates[CALIBRATIONS / 2];
+    if (verbose) {
+	printf("Time stamp counter rate ~= %.1f MHz", rate);
+#if defined(__i386__) || defined(__x86_64__)
+	if (!has_invariant_tsc())
+	    printf(" (not invariant: frequency changes will skew it)");
+#endif
+	printf("\n");
+    }
+    return rate;
+}
+
 /** Special counters that compensate for timer interrupt overhead */
 
 static double cyc_per_tick = 0.0;
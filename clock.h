@@ -1,5 +1,20 @@
 /* Routines for using cycle counter */
 
+/* 
+ * Sources of read_counter: CPU cycles (rdtsc, as start_counter and
+ * get_counter count), the time stamp counter read with rdtscp, or the
+ * nanoseconds of clock_gettime(CLOCK_MONOTONIC_RAW)
+ */
+#define COUNTER_CYCLES 0
+#define COUNTER_RDTSCP 1
+#define COUNTER_MONOTONIC 2
+
+/* Is the source available here? */
+int counter_available(int source);
+
+/* Current count of the source */
+unsigned long long read_counter(int source);
+
 /* Start the counter */
 void start_counter();
 
@@ -15,6 +30,10 @@ double mhz(int verbose);
 /* Determine clock rate of processor, having more control over accuracy */
 double mhz_full(int verbose, int sleeptime);
 
+/* Rate of a source in counts per microsecond, timed against the
+   monotonic clock */
+double counter_mhz(int source, int verbose);
+
 /** Special counters that compensate for timer interrupt overhead */
 
 void start_comp_counter();
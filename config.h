@@ -68,5 +68,7 @@
 #define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
 #define USE_GETTOD 1   /* gettimeofday (any Unix box) */
+#define USE_MONOTONIC 0 /* clock_gettime(CLOCK_MONOTONIC_RAW) w/K-best scheme */
+#define USE_RDTSCP 0   /* rdtscp w/K-best scheme, rate timed on the monotonic clock (x86) */
 
 #endif /* __CONFIG_H */
@@ -30,6 +30,7 @@ static int compensate = COMPENSATE;
 static int clear_cache = CLEAR_CACHE;
 static int cache_bytes = CACHE_BYTES;
 static int cache_block = CACHE_BLOCK;
+static int counter = COUNTER_CYCLES;
 
 static int *cache_buf = NULL;
 
@@ -143,11 +144,12 @@ double fcyc(test_funct f, void *argp)
     } else {
 	do {
 	    double cyc;
+	    unsigned long long start;
 	    if (clear_cache)
 		clear();
-	    start_counter();
+	    start = read_counter(counter);
 	    f(argp);
-	    cyc = get_counter();
+	    cyc = (double)(read_counter(counter) - start);
 	    add_sample(cyc);
 	} while (!has_converged() && samplecount < maxsamples);
     }
@@ -216,6 +218,16 @@ void set_fcyc_compensate(int compensate_arg)
     compensate = compensate_arg;
 }
 
+/* 
+ * set_fcyc_counter - Source of the counts fcyc returns (see clock.h),
+ *     when it does not compensate for timer interrupts
+ *     Default = COUNTER_CYCLES
+ */
+void set_fcyc_counter(int source)
+{
+    counter = source;
+}
+
 /* 
  * set_fcyc_k - Value of K in K-best measurement scheme
  *     Default = 3
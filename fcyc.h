@@ -43,6 +43,13 @@ void set_fcyc_cache_block(int bytes);
  */
 void set_fcyc_compensate(int compensate_arg);
 
+/* 
+ * set_fcyc_counter - Source of the counts fcyc returns (see clock.h),
+ *     when it does not compensate for timer interrupts
+ *     Default = COUNTER_CYCLES
+ */
+void set_fcyc_counter(int source);
+
 /* 
  * set_fcyc_k - Value of K in K-best measurement scheme
  *     Default = 3
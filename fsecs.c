@@ -2,41 +2,124 @@
  * High-level timing wrappers
  ****************************/
 #include <stdio.h>
+#include <string.h>
 #include "fsecs.h"
 #include "fcyc.h"
 #include "clock.h"
 #include "ftimer.h"
 #include "config.h"
 
+/* Timing methods, named as fsecs_set_method and fsecs_method know them */
+enum {FCYC, ITIMER, GETTOD, MONOTONIC, RDTSCP, NUM_METHODS};
+static const char *method_names[NUM_METHODS] = 
+    {"fcyc", "itimer", "gettimeofday", "monotonic", "rdtscp"};
+
+/* Counter methods time at least this long a sample, repeating f */
+#define MIN_SAMPLE_SECS 1e-3
+
+#if USE_FCYC
+static int method = FCYC;
+#elif USE_ITIMER
+static int method = ITIMER;
+#elif USE_MONOTONIC
+static int method = MONOTONIC;
+#elif USE_RDTSCP
+static int method = RDTSCP;
+#else
+static int method = GETTOD;
+#endif
+
 static double Mhz;  /* estimated CPU clock frequency */
 
+/* f(argp), reps times in a row: one sample of fcyc */
+typedef struct {
+    fsecs_test_funct f;
+    void *argp;
+    int reps;
+} repeat_t;
+
 extern int verbose; /* -v option in mdriver.c */
 
+/*
+ * fsecs_set_method - Select the timing method by its name, before
+ *     init_fsecs. Return -1 if it is unknown or not available here.
+ */
+int fsecs_set_method(const char *name)
+{
+    int i;
+
+    for (i = 0; i < NUM_METHODS; i++)
+	if (strcmp(name, method_names[i]) == 0)
+	    break;
+    if (i == NUM_METHODS)
+	return -1;
+    if (i == RDTSCP && !counter_available(COUNTER_RDTSCP))
+	return -1;
+    method = i;
+    return 0;
+}
+
 /*
  * init_fsecs - initialize the timing package
  */
 void init_fsecs(void)
 {
+    int counter;
+
     Mhz = 0; /* keep gcc -Wall happy */
 
-#if USE_FCYC
-    if (verbose)
-	printf("Measuring performance with a cycle counter.\n");
-
-    /* set key parameters for the fcyc package */
-    set_fcyc_maxsamples(20); 
-    set_fcyc_clear_cache(1);
-    set_fcyc_compensate(1);
-    set_fcyc_epsilon(0.01);
-    set_fcyc_k(3);
-    Mhz = mhz(verbose > 0);
-#elif USE_ITIMER
-    if (verbose)
-	printf("Measuring performance with the interval timer.\n");
-#elif USE_GETTOD
-    if (verbose)
-	printf("Measuring performance with gettimeofday().\n");
-#endif
+    switch (method) {
+    case FCYC:
+    case MONOTONIC:
+    case RDTSCP:
+	if (verbose)
+	    printf("Measuring performance with %s.\n", 
+		   (method == FCYC) ? "a cycle counter" :
+		   (method == RDTSCP) ? "rdtscp" : "the monotonic clock");
+
+	/* set key parameters for the fcyc package */
+	set_fcyc_maxsamples(20); 
+	set_fcyc_clear_cache(1);
+	set_fcyc_epsilon(0.01);
+	set_fcyc_k(3);
+	if (method == FCYC) {
+	    set_fcyc_counter(COUNTER_CYCLES);
+	    set_fcyc_compensate(1);
+	    Mhz = mhz(verbose > 0);
+	}
+	else {
+	    /* 
+	     * wall-clock counters, read by fcyc alone: start_counter and
+	     * get_counter still count the cycles the reports of mdriver
+	     * show. K-best filters out the interrupts.
+	     */
+	    counter = (method == RDTSCP) ? COUNTER_RDTSCP : COUNTER_MONOTONIC;
+	    set_fcyc_counter(counter);
+	    set_fcyc_compensate(0);
+	    Mhz = counter_mhz(counter, verbose > 0);
+	}
+	break;
+    case ITIMER:
+	if (verbose)
+	    printf("Measuring performance with the interval timer.\n");
+	break;
+    case GETTOD:
+	if (verbose)
+	    printf("Measuring performance with gettimeofday().\n");
+	break;
+    }
+}
+
+/*
+ * repeat - run a repeat_t
+ */
+static void repeat(void *argp)
+{
+    repeat_t *r = (repeat_t *)argp;
+    int i;
+
+    for (i = 0; i < r->reps; i++)
+	r->f(r->argp);
 }
 
 /*
@@ -44,14 +127,34 @@ void init_fsecs(void)
  */
 double fsecs(fsecs_test_funct f, void *argp) 
 {
-#if USE_FCYC
-    double cycles = fcyc(f, argp);
-    return cycles/(Mhz*1e6);
-#elif USE_ITIMER
-    return ftimer_itimer(f, argp, 10);
-#elif USE_GETTOD
-    return ftimer_gettod(f, argp, 10);
-#endif 
-}
+    repeat_t r;
+    double secs;
 
+    switch (method) {
+    case ITIMER:
+	return ftimer_itimer(f, argp, 10);
+    case GETTOD:
+	return ftimer_gettod(f, argp, 10);
+    default:
+	/* 
+	 * A sample shorter than MIN_SAMPLE_SECS is mostly counter
+	 * overhead and noise: time f enough times in a row instead
+	 */
+	r.f = f;
+	r.argp = argp;
+	r.reps = 1;
+	secs = fcyc(repeat, &r) / (Mhz*1e6);
+	if (secs >= MIN_SAMPLE_SECS)
+	    return secs;
+	r.reps = (secs > MIN_SAMPLE_SECS / 1e6) ? (int)(MIN_SAMPLE_SECS / secs) + 1 : 1000000;
+	return fcyc(repeat, &r) / (Mhz*1e6) / r.reps;
+    }
+}
 
+/*
+ * fsecs_method - Name the timing method fsecs uses
+ */
+const char *fsecs_method(void)
+{
+    return method_names[method];
+}
@@ -1,4 +1,6 @@
 typedef void (*fsecs_test_funct)(void *);
 
 void init_fsecs(void);
+int fsecs_set_method(const char *name);
 double fsecs(fsecs_test_funct f, void *argp);
+const char *fsecs_method(void);
@@ -10,15 +10,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <math.h>
 #include <errno.h>
 #include <string.h>
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sched.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "clock.h"
+#include "trace.h"
 #include "config.h"
 
 /**********************
@@ -29,6 +36,36 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define COMPACT_BUDGET (1<<16) /* bytes mm_compact may slide per call (-c) */
+
+#define PROFILE_SAMPLE 65536   /* mean bytes between heap profile samples (-P) */
+
+/* Streaming replay (-S) */
+#define STREAM_CHUNK_OPS (1<<16) /* ops per chunk, a multiple of the binary blocks */
+#define STREAM_IDS 1024          /* initial slots of the table of live ids */
+
+/* Threaded replay (-T) */
+#define THREAD_REPS 16           /* replays of the trace by each thread */
+#define THREAD_SPINS 64          /* polls of a sequence wait before a yield */
+
+/* Latency histograms (-H) */
+#define HIST_SUB_BITS 5          /* 32 linear buckets per power of two: 3% error */
+#define HIST_BUCKETS ((65 - HIST_SUB_BITS) << HIST_SUB_BITS)
+#define LATENCY_BANDS 4          /* request sizes up to 64, 512, 4096 bytes, larger */
+#define TIMER_CALIBRATION 10000  /* back-to-back timer reads to measure its cost */
+
+/* Benchmark reports (--json, --csv) and their comparison (--compare) */
+#define STAT_RUNS 5              /* timings of each trace, for a mean and a deviation */
+#define DEFAULT_THRESHOLD 5.0    /* % of Kops or util lost that fails --compare */
+#define T_CRITICAL 2.5           /* Welch t beyond which a slowdown is not noise */
+
+/* Codes of the long options, past any char */
+enum {OPT_JSON = 256, OPT_CSV, OPT_COMPARE, OPT_THRESHOLD, OPT_TIMER};
+
+/* Realloc move sweep (-C) */
+#define SWEEP_MIN (4<<10)      /* smallest payload moved */
+#define SWEEP_MAX (8<<20)      /* largest: MAX_HEAP must hold it twice */
+#define SWEEP_REPS 8           /* moves timed per size, the fastest is kept */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
@@ -37,30 +74,94 @@
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* 
+ * Records the extent of each block's payload. The ranges form a skip
+ * list sorted by address, whose head is a range with no extent: level
+ * k links about one range in 4^k, so that a search skips most of them.
+ */
+#define RANGE_LEVELS 12   /* enough for 4^12 = 16M ranges */
+#define RANGE_CHUNK 1024  /* ranges the pool takes from malloc at once */
+
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    int levels;            /* number of lists this range is on */
+    struct range_t *next[RANGE_LEVELS]; /* next range on each list */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
+/*
+ * A trace replayed by streaming (-S): a background thread reads the
+ * ops by chunks into one buffer while the replay consumes the other.
+ */
+typedef struct {
+    trace_stream_t *stream;
+    traceop_t *chunk[2];       /* the two buffers */
+    int count[2];              /* ops in each buffer, -1 while it is empty */
+    pthread_mutex_t lock;
+    pthread_cond_t changed;    /* a buffer was filled or emptied */
+} stream_t;
+
+/*
+ * State shared by the threads of a thread-tagged trace (-T): each
+ * thread runs the ops of its tag, in the order of the file, and waits
+ * before an op until the ops before it on the same id are done
+ */
+typedef struct {
+    int *order;                /* op indices, grouped by thread */
+    int *first;                /* per thread, where its ops start in order */
+    int *seq;                  /* per op, its rank among the ops of its id */
+    int *stage;                /* per id, ops done on it in this replay */
+    int *owner;                /* per id, thread whose heap holds the block */
+    int *sizes;                /* per id, payload bytes */
+    char **blocks;             /* per id, the block */
+    mm_heap_t **heaps;         /* per thread, its heap */
+} tags_t;
+
+/*
+ * One thread of a threaded replay (-T): it replays the whole trace
+ * with its own blocks and regions, or its part of a thread-tagged one,
+ * in a heap of its own (or libc's)
+ */
+typedef struct {
+    trace_t *trace;
+    int thread;                /* its tag */
+    int use_libc;              /* malloc/free/realloc instead of mm_xxx */
+    tags_t *tags;              /* NULL to replay the whole trace */
+    char **blocks;             /* this thread's pointers, by id */
+    mm_region_t **regions;     /* this thread's regions, by region id */
+    pthread_barrier_t *ready;  /* all the threads start at once */
+    double start;              /* when it started, in secs */
+    double secs;               /* how long it took */
+    double ops;                /* how many ops it ran */
+} replayer_t;
+
+/* The numbers of one trace in a --json report read back by --compare */
+typedef struct {
+    char trace[MAXLINE];
+    int valid;
+    int runs;
+    double kops;
+    double secs;
+    double secs_sd;
+    double util;
+} baseline_t;
+
+/*
+ * Log-linear histogram of latencies in ns (-H): exact below 32 ns,
+ * then 32 buckets of equal width per power of two, as in HdrHistogram
+ */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
+    unsigned long count[HIST_BUCKETS];
+    unsigned long total;
+    unsigned long long max;
+} hist_t;
 
-/* Holds the information for one trace file*/
+/* Slot of the table of live ids of a streamed replay (-S) */
 typedef struct {
-    int sugg_heapsize;   /* suggested heap size (unused) */
-    int num_ids;         /* number of alloc/realloc ids */
-    int num_ops;         /* number of distinct requests */
-    int weight;          /* weight for this trace (unused) */
-    traceop_t *ops;      /* array of requests */
-    char **blocks;       /* array of ptrs returned by malloc/realloc... */
-    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
-} trace_t;
+    int id;                    /* -1 if the slot is free */
+    int size;
+    char *p;
+} id_slot_t;
 
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
@@ -78,9 +179,29 @@ typedef struct {
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
+    double secs_sd;  /* standard deviation of secs over the runs */
+    int runs;        /* number of timings secs is the mean of */
+    int errors;      /* errors found in the trace */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double probes;   /* blocks examined by the free space search (-p) */
+    double cycles;   /* cycles of the replay that examined them (-p) */
+    double reallocs; /* number of realloc ops in the trace (-r) */
+    double shrinks;  /* reallocs that gave the tail of their block back (-r) */
+    double realloc_cycles; /* cycles spent in mm_realloc (-r) */
+    double handle_util[2];    /* peak util of the handle replay, without and with mm_compact (-c) */
+    double handle_avg_util[2];/* ... and util averaged over the ops (-c) */
+    double moved;             /* bytes slid by mm_compact (-c) */
+    double compact_cycles;    /* cycles spent in mm_compact (-c) */
+    double hinted_util;       /* util with oracle lifetime hints (-L) */
+    double stall_secs;        /* secs the replay waited for the reader (-S) */
+    double short_lived;       /* fraction of the blocks hinted short-lived (-L) */
+    double solo_secs;         /* secs of a single thread replaying alone (-T) */
+    int threads;              /* threads replaying at once (-T) */
+    double *thread_secs;      /* secs of each of them (-T) */
+    double *thread_ops;       /* ops of each of them (-T) */
+    double remote;            /* frees of another thread's block, per replay (-T) */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
@@ -95,6 +216,49 @@ char msg[MAXLINE];      /* for whenever we need to compose an error message */
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
+/* If set, mm_init is told the suggested heap size of the trace (-s) */
+static int hint_heapsize = 0;
+
+/* Number of replays of each trace timed by eval_mm_speed (-i) */
+static int replay_iterations = 1;
+
+/* If set, eval_mm_speed counts the cycles spent in mm_realloc (-r) */
+static int time_reallocs = 0;
+static double realloc_cycles = 0;
+
+/* Free range records, linked by next[0], and the seed of their levels */
+static range_t *range_pool = NULL;
+static unsigned int range_seed = 1;
+
+/* Live ids of a streamed replay, open addressing on the id (-S) */
+static id_slot_t *ids = NULL;
+static int ids_capacity = 0;
+static int ids_live = 0;
+
+/* Lifetime hint of each block id for eval_mm_util, NULL for none (-L) */
+static int *alloc_hints = NULL;
+
+/* 
+ * Latencies of mm_malloc, mm_free and mm_realloc (rows indexed by the
+ * ALLOC, FREE and REALLOC op types) by size band, NULL if no -H, and
+ * the cost of a timer read that is taken off each of them
+ */
+static hist_t (*latency)[LATENCY_BANDS] = NULL;
+static unsigned long long timer_overhead = 0;
+static int band_limits[LATENCY_BANDS - 1] = {64, 512, 4096};
+
+/* Number of threads replaying each trace at once, 0 if no -T */
+static int num_threads = 0;
+
+/* Ops between two mm_compact calls of the handle replay, 0 if no -c */
+static int compact_period = 0;
+
+/* The real stdout when a report goes there (--json - or --csv -), NULL if none */
+static FILE *report_stdout = NULL;
+
+/* The regions of the trace being replayed, created on first use */
+static mm_region_t **regions = NULL;
+
 /* The filenames of the default tracefiles */
 static char *default_tracefiles[] = {  
     DEFAULT_TRACEFILES, NULL
@@ -110,10 +274,12 @@ static int add_range(range_t **ranges, char *lo, int size,
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static range_t *new_range(void);
+static void find_range(range_t *head, char *lo, range_t **before);
 
-/* These functions read, allocate, and free storage for traces */
-static trace_t *read_trace(char *tracedir, char *filename);
-static void free_trace(trace_t *trace);
+/* these functions manage the mm regions of region-tagged traces */
+static void reset_regions(trace_t *trace);
+static mm_region_t *get_region(int region);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
@@ -124,9 +290,52 @@ static void eval_libc_speed(void *ptr);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void replay_mm(trace_t *trace);
+static void eval_mm_probes(speed_t *speed_params, stats_t *stats);
+static void eval_mm_reallocs(speed_t *speed_params, stats_t *stats);
+static void eval_mm_compact(trace_t *trace, int tracenum, stats_t *stats);
+static void eval_realloc_sweep(void);
+static void eval_mm_stream(char *filename, int tracenum, stats_t *stats);
+static void eval_mm_latency(trace_t *trace);
+static void record_latency(int type, int size, unsigned long long ns);
+static void calibrate_timer(void);
+static unsigned long long now_ns(void);
+static void hist_add(hist_t *hist, unsigned long long value);
+static unsigned long long hist_quantile(hist_t *hist, double q);
+static void *stream_reader(void *arg);
+static void eval_threads(trace_t *trace, int use_libc, stats_t *stats);
+static double run_threads(trace_t *trace, int use_libc, int n, tags_t *tags,
+			  double *secs, double *ops);
+static tags_t *new_tags(trace_t *trace, double *remote);
+static void free_tags(tags_t *tags);
+static void wait_turn(int *stage, int id, int seq);
+static void *replay_thread(void *arg);
+static id_slot_t *find_id(int id, int insert);
+static void remove_id(id_slot_t *slot);
+static void eval_mm_hints(trace_t *trace, int tracenum, range_t **ranges, 
+			  stats_t *stats);
+static double time_realloc_move(int size, size_t threshold);
+static void replay_handles(trace_t *trace, int tracenum, int period, 
+			   stats_t *stats, int slot);
+static int init_mm(trace_t *trace);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printprobes(int n, stats_t *stats);
+static void printreallocs(int n, stats_t *stats);
+static void printcompact(int n, stats_t *stats);
+static void printhints(int n, stats_t *stats);
+static void printstream(int n, stats_t *stats);
+static void printthreads(int n, stats_t *stats);
+static void printlatency(void);
+static void time_trace(fsecs_test_funct f, speed_t *speed_params, stats_t *stats);
+static void write_json(FILE *out, int n, char **tracefiles, stats_t *stats,
+		       double perfindex);
+static void write_csv(FILE *out, int n, char **tracefiles, stats_t *stats);
+static FILE *open_report(char *path);
+static baseline_t *read_baseline(char *path, int *n);
+static int compare_baseline(char *path, int n, char **tracefiles, stats_t *stats, 
+			    double threshold);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -138,7 +347,7 @@ static void app_error(char *msg);
 int main(int argc, char **argv)
 {
     int i;
-    char c;
+    int c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
@@ -150,6 +359,29 @@ int main(int argc, char **argv)
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int probe_mode = 0;  /* If set, report cycles per free space probe (-p) */
+    int realloc_mode = 0;/* If set, report the cost of mm_realloc (-r) */
+    int sweep_mode = 0;  /* If set, time realloc moves by size (-C) */
+    int hint_mode = 0;   /* If set, replay with oracle lifetime hints (-L) */
+    int stream_mode = 0; /* If set, stream the traces instead (-S) */
+    int latency_mode = 0;/* If set, report the latency of each call (-H) */
+    char *profile_file = NULL; /* If set, heap profiles go to <file>.<trace> (-P) */
+    char profile_name[MAXLINE];
+    FILE *profile;
+    char *json_file = NULL;    /* If set, write a JSON report there (--json) */
+    char *csv_file = NULL;     /* If set, write a CSV report there (--csv) */
+    char *baseline_file = NULL;/* If set, compare with this JSON report (--compare) */
+    double threshold = DEFAULT_THRESHOLD; /* % lost that fails --compare */
+    int regressions = 0;
+    FILE *report;
+    static struct option long_options[] = {
+	{"json", required_argument, NULL, OPT_JSON},
+	{"csv", required_argument, NULL, OPT_CSV},
+	{"compare", required_argument, NULL, OPT_COMPARE},
+	{"threshold", required_argument, NULL, OPT_THRESHOLD},
+	{"timer", required_argument, NULL, OPT_TIMER},
+	{NULL, 0, NULL, 0}
+    };
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,8 +390,32 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt_long(argc, argv, "f:t:hvVgalprR:si:c:CP:LST:H", 
+			    long_options, NULL)) != EOF) {
         switch (c) {
+        case OPT_JSON: /* Write the results as JSON, "-" for stdout */
+            json_file = optarg;
+            break;
+        case OPT_CSV: /* Write the results as CSV, "-" for stdout */
+            csv_file = optarg;
+            break;
+        case OPT_COMPARE: /* Compare with the JSON results of an earlier run */
+            baseline_file = optarg;
+            break;
+        case OPT_TIMER: /* Timing method of fsecs */
+            if (fsecs_set_method(optarg) < 0) {
+		fprintf(stderr, "Timer %s is unknown or not available here\n", optarg);
+		usage();
+		exit(1);
+	    }
+            break;
+        case OPT_THRESHOLD: /* % of Kops or util a trace may lose (--compare) */
+            threshold = atof(optarg);
+            if (threshold < 0) {
+		usage();
+		exit(1);
+	    }
+            break;
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
 	    break;
@@ -184,6 +440,54 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'p': /* Report cycles per probe of the free space search */
+            probe_mode = 1;
+            break;
+        case 'r': /* Report utilization and cycles of mm_realloc */
+            realloc_mode = 1;
+            break;
+        case 'R': /* Tails a shrinking mm_realloc keeps, in bytes */
+            mm_set_realloc_slack(atoi(optarg));
+            break;
+        case 's': /* Start each trace with its suggested heap size */
+            hint_heapsize = 1;
+            break;
+        case 'i': /* Replay each trace n times, with mm_reset in between */
+            replay_iterations = atoi(optarg);
+            if (replay_iterations < 1) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'c': /* Replay with handles, mm_compact every n ops */
+            compact_period = atoi(optarg);
+            if (compact_period < 1) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'C': /* Time realloc moves of growing sizes */
+            sweep_mode = 1;
+            break;
+        case 'S': /* Stream the traces by chunks, for the largest ones */
+            stream_mode = 1;
+            break;
+        case 'T': /* Replay each trace in n threads at once */
+            num_threads = atoi(optarg);
+            if (num_threads < 1) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'H': /* Report latency percentiles of each call */
+            latency_mode = 1;
+            break;
+        case 'L': /* Replay with the lifetimes of the trace as hints */
+            hint_mode = 1;
+            break;
+        case 'P': /* Write a heap profile of each trace */
+            profile_file = optarg;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -198,6 +502,24 @@ int main(int argc, char **argv)
             exit(1);
         }
     }
+
+    /*
+     * A report sent to stdout must be the only thing there: the
+     * driver's own output goes to stderr instead
+     */
+    if ((json_file && !strcmp(json_file, "-")) || (csv_file && !strcmp(csv_file, "-"))) {
+	int fd;
+
+	if (json_file && csv_file && !strcmp(json_file, csv_file)) {
+	    fprintf(stderr, "Only one of --json and --csv can write to stdout\n");
+	    usage();
+	    exit(1);
+	}
+	if ((fd = dup(STDOUT_FILENO)) < 0 || (report_stdout = fdopen(fd, "w")) == NULL ||
+	    dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+	    unix_error("Could not keep stdout for the report");
+	setvbuf(stdout, NULL, _IOLBF, 0);
+    }
 	
     /* 
      * Check and print team info 
@@ -237,6 +559,36 @@ int main(int argc, char **argv)
 
     /* Initialize the timing package */
     init_fsecs();
+    if (latency_mode) {
+	if ((latency = calloc(REALLOC + 1, sizeof(*latency))) == NULL)
+	    unix_error("latency calloc in main failed");
+	calibrate_timer();
+    }
+
+    /*
+     * With -T, the traces are only replayed by threads at once, each
+     * thread in a heap of its own, and compared with a thread alone
+     */
+    if (num_threads) {
+	mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	libc_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	if (mm_stats == NULL || libc_stats == NULL)
+	    unix_error("stats calloc in main failed");
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_threads(trace, 0, &mm_stats[i]);
+	    if (run_libc)
+		eval_threads(trace, 1, &libc_stats[i]);
+	    free_trace(trace);
+	}
+	if (run_libc) {
+	    printf("\nThreaded replay of libc malloc:\n");
+	    printthreads(num_tracefiles, libc_stats);
+	}
+	printf("\nThreaded replay of mm malloc:\n");
+	printthreads(num_tracefiles, mm_stats);
+	exit(0);
+    }
 
     /*
      * Optionally run and evaluate the libc malloc package 
@@ -287,12 +639,27 @@ int main(int argc, char **argv)
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
 
+    /*
+     * Streamed traces are replayed once, without the checks that need
+     * the whole trace in memory
+     */
+    if (stream_mode) {
+	for (i=0; i < num_tracefiles; i++)
+	    eval_mm_stream(tracefiles[i], i, &mm_stats[i]);
+	printf("\nStreamed replay of mm malloc:\n");
+	printstream(num_tracefiles, mm_stats);
+	exit(errors ? 1 : 0);
+    }
+
     /* Evaluate student's mm malloc package using the K-best scheme */
     for (i=0; i < num_tracefiles; i++) {
 	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
+	mm_stats[i].ops = (double)trace->num_ops * replay_iterations;
+	if (profile_file != NULL && mm_profile_start(PROFILE_SAMPLE) < 0)
+	    unix_error("mm_profile_start failed in main");
 	if (verbose > 1)
 	    printf("Checking mm_malloc for correctness, ");
+	mm_stats[i].errors = errors;
 	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
 	if (mm_stats[i].valid) {
 	    if (verbose > 1)
@@ -302,11 +669,35 @@ int main(int argc, char **argv)
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
 		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    /* reports time each trace several times, to tell noise from changes */
+	    mm_stats[i].runs = (json_file || csv_file || baseline_file) ? STAT_RUNS : 1;
+	    time_trace(eval_mm_speed, &speed_params, &mm_stats[i]);
+	    if (probe_mode)
+		eval_mm_probes(&speed_params, &mm_stats[i]);
+	    if (realloc_mode)
+		eval_mm_reallocs(&speed_params, &mm_stats[i]);
+	    if (compact_period)
+		eval_mm_compact(trace, i, &mm_stats[i]);
+	    if (hint_mode)
+		eval_mm_hints(trace, i, &ranges, &mm_stats[i]);
+	    if (latency_mode)
+		eval_mm_latency(trace);
 	}
+	if (profile_file != NULL) {
+	    sprintf(profile_name, "%s.%d", profile_file, i);
+	    if ((profile = fopen(profile_name, "w")) == NULL)
+		unix_error("fopen of the heap profile failed in main");
+	    if (mm_profile_dump(profile) < 0)
+		app_error("mm_profile_dump failed in main");
+	    fclose(profile);
+	}
+	mm_stats[i].errors = errors - mm_stats[i].errors;
 	free_trace(trace);
     }
 
+    if (profile_file != NULL)
+	mm_profile_start(0);
+
     /* Display the mm results in a compact table */
     if (verbose) {
 	printf("\nResults for mm malloc:\n");
@@ -314,6 +705,50 @@ int main(int argc, char **argv)
 	printf("\n");
     }
 
+    /* Display the cost of the free space search */
+    if (probe_mode) {
+	printf("Free space search in mm malloc:\n");
+	printprobes(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display the cost of mm_realloc */
+    if (realloc_mode) {
+	printf("Realloc in mm malloc:\n");
+	printreallocs(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display what compaction gains, and what it costs */
+    if (compact_period) {
+	printf("Compaction every %d ops in mm malloc:\n", compact_period);
+	printcompact(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display the utilization lifetime hints could reach */
+    if (hint_mode) {
+	printf("Oracle lifetime hints in mm malloc:\n");
+	printhints(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display the tail latencies of the calls */
+    if (latency_mode) {
+	printf("Latency of mm malloc in ns, %llu ns of timer cost taken off:\n", 
+	       timer_overhead);
+	printlatency();
+	printf("\n");
+    }
+
+    /* Display the cost of realloc moves, with and without the copy kernel */
+    if (sweep_mode) {
+	printf("Realloc moves in mm malloc (large copy kernel: %s):\n", 
+	       mm_copy_kernel());
+	eval_realloc_sweep();
+	printf("\n");
+    }
+
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
      */
@@ -362,7 +797,25 @@ int main(int argc, char **argv)
 	printf("perfidx:%.0f\n", perfindex);
     }
 
-    exit(0);
+    /* Machine-readable reports, and the comparison with an earlier one */
+    if (json_file) {
+	report = open_report(json_file);
+	write_json(report, num_tracefiles, tracefiles, mm_stats, perfindex);
+	fclose(report);
+    }
+    if (csv_file) {
+	report = open_report(csv_file);
+	write_csv(report, num_tracefiles, tracefiles, mm_stats);
+	fclose(report);
+    }
+    if (baseline_file) {
+	printf("\nCompared with %s (threshold %.1f%%):\n", baseline_file, threshold);
+	regressions = compare_baseline(baseline_file, num_tracefiles, tracefiles, 
+				       mm_stats, threshold);
+	printf("%d regression%s\n", regressions, (regressions == 1) ? "" : "s");
+    }
+
+    exit(regressions ? 2 : 0);
 }
 
 
@@ -370,8 +823,48 @@ int main(int argc, char **argv)
  * The following routines manipulate the range list, which keeps 
  * track of the extent of every allocated block payload. We use the 
  * range list to detect any overlapping allocated blocks.
+ * The list is a skip list, so that checking, adding and removing a
+ * range take O(log n) instead of a walk of all the live blocks.
  ****************************************************************/
 
+/*
+ * new_range - Take a range record from the pool, refilling the pool
+ *     by RANGE_CHUNK records when it is empty
+ */
+static range_t *new_range(void)
+{
+    range_t *p;
+    int i;
+
+    if (range_pool == NULL) {
+	if ((p = (range_t *)malloc(RANGE_CHUNK * sizeof(range_t))) == NULL)
+	    unix_error("malloc error in new_range");
+	for (i = 0; i < RANGE_CHUNK; i++) {
+	    p[i].next[0] = range_pool;
+	    range_pool = &p[i];
+	}
+    }
+    p = range_pool;
+    range_pool = p->next[0];
+    return p;
+}
+
+/*
+ * find_range - Fill before[k] with the last range of list k that starts
+ *     below lo (the head if there is none)
+ */
+static void find_range(range_t *head, char *lo, range_t **before)
+{
+    range_t *p = head;
+    int k;
+
+    for (k = RANGE_LEVELS - 1; k >= 0; k--) {
+	while (p->next[k] != NULL && p->next[k]->lo < lo)
+	    p = p->next[k];
+	before[k] = p;
+    }
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
@@ -382,8 +875,10 @@ static int add_range(range_t **ranges, char *lo, int size,
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *next;
+    range_t *before[RANGE_LEVELS];
     char msg[MAXLINE];
+    int k;
 
     assert(size > 0);
 
@@ -404,27 +899,46 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    if (*ranges == NULL) {
+	*ranges = new_range();
+	(*ranges)->lo = (*ranges)->hi = NULL;
+	(*ranges)->levels = RANGE_LEVELS;
+	for (k = 0; k < RANGE_LEVELS; k++)
+	    (*ranges)->next[k] = NULL;
+    }
+
+    /* 
+     * The payload must not overlap any other payloads. The ranges are
+     * disjoint and sorted, so only its neighbours can overlap it.
+     */
+    find_range(*ranges, lo, before);
+    p = before[0];
+    next = p->next[0];
+    if (p == *ranges || p->hi < lo)
+	p = next;
+    if (p != NULL && p->lo <= hi && p->hi >= lo) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
      * by creating a range struct and adding it the range list.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
+    p = new_range();
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    for (p->levels = 1; p->levels < RANGE_LEVELS; p->levels++) {
+	range_seed = range_seed * 1103515245 + 12345;
+	if (((range_seed >> 16) & 3) != 0)
+	    break;
+    }
+    for (k = 0; k < p->levels; k++) {
+	p->next[k] = before[k]->next[k];
+	before[k]->next[k] = p;
+    }
     return 1;
 }
 
@@ -434,22 +948,24 @@ static int add_range(range_t **ranges, char *lo, int size,
 static void remove_range(range_t **ranges, char *lo)
 {
     range_t *p;
-    range_t **prevpp = ranges;
-    int size;
-
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
-    }
+    range_t *before[RANGE_LEVELS];
+    int k;
+
+    if (*ranges == NULL)
+	return;
+    find_range(*ranges, lo, before);
+    p = before[0]->next[0];
+    if (p == NULL || p->lo != lo)
+	return;
+    for (k = 0; k < p->levels; k++)
+	before[k]->next[k] = p->next[k];
+    p->next[0] = range_pool;
+    range_pool = p;
 }
 
 /*
- * clear_ranges - free all of the range records for a trace 
+ * clear_ranges - give all of the range records for a trace back to
+ *     the pool, the head of the list included
  */
 static void clear_ranges(range_t **ranges)
 {
@@ -457,120 +973,56 @@ static void clear_ranges(range_t **ranges)
     range_t *pnext;
 
     for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
+        pnext = p->next[0];
+        p->next[0] = range_pool;
+        range_pool = p;
     }
     *ranges = NULL;
 }
 
 
-/**********************************************
- * The following routines manipulate tracefiles
- *********************************************/
-
 /*
- * read_trace - read a trace file and store it in memory
+ * reset_regions - Forget the regions of the previous replay, which
+ *     lived in the heap mm_init just reset
  */
-static trace_t *read_trace(char *tracedir, char *filename)
+static void reset_regions(trace_t *trace)
 {
-    FILE *tracefile;
-    trace_t *trace;
-    char type[MAXLINE];
-    char path[MAXLINE];
-    unsigned index, size;
-    unsigned max_index = 0;
-    unsigned op_index;
-
-    if (verbose > 1)
-	printf("Reading tracefile: %s\n", filename);
-
-    /* Allocate the trace record */
-    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
-	unix_error("malloc 1 failed in read_trance");
-	
-    /* Read the trace file header */
-    strcpy(path, tracedir);
-    strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
-	sprintf(msg, "Could not open %s in read_trace", path);
-	unix_error(msg);
-    }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));     
-    fscanf(tracefile, "%d", &(trace->num_ops));     
-    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
-    
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
-
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks = 
-	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-	unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes = 
-	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-	unix_error("malloc 4 failed in read_trace");
-    
-    /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-	switch(type[0]) {
-	case 'a':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = ALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'r':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = REALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'f':
-	    fscanf(tracefile, "%ud", &index);
-	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
-	    break;
-	default:
-	    printf("Bogus type character (%c) in tracefile %s\n", 
-		   type[0], path);
-	    exit(1);
-	}
-	op_index++;
-	
-    }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
-    
-    return trace;
+    if (trace->num_regions == 0)
+	return;
+    free(regions);
+    if ((regions = (mm_region_t **)calloc(trace->num_regions,
+					  sizeof(mm_region_t *))) == NULL)
+	unix_error("calloc error in reset_regions");
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ * get_region - Return the mm region of a region id, creating it on
+ *     first use. Returns NULL if mm_region_create fails.
  */
-void free_trace(trace_t *trace)
+static mm_region_t *get_region(int region)
 {
-    free(trace->ops);         /* free the three arrays... */
-    free(trace->blocks);      
-    free(trace->block_sizes);
-    free(trace);              /* and the trace record itself... */
+    if (regions[region] == NULL)
+	regions[region] = mm_region_create(0);
+    return regions[region];
 }
 
+
 /**********************************************************************
  * The following functions evaluate the correctness, space utilization,
  * and throughput of the libc and mm malloc packages.
  **********************************************************************/
 
+/*
+ * init_mm - Initialize the mm package for a replay of the trace, with
+ *     its suggested heap size and peak number of live blocks if -s
+ */
+static int init_mm(trace_t *trace)
+{
+    if (hint_heapsize)
+	return mm_init_hint(trace->sugg_heapsize, trace->peak_live);
+    return mm_init();
+}
+
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
@@ -589,10 +1041,11 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     clear_ranges(ranges);
 
     /* Call the mm package's init function */
-    if (mm_init() < 0) {
+    if (init_mm(trace) < 0) {
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
     }
+    reset_regions(trace);
 
     /* Interpret each operation in the trace in order */
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -653,7 +1106,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -674,6 +1127,44 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    mm_free(p);
 	    break;
 
+        case REGION_ALLOC: /* mm_region_alloc */
+
+	    /* Same checks as mm_malloc, the block comes from a region */
+	    if (get_region(trace->ops[i].region) == NULL) {
+		malloc_error(tracenum, i, "mm_region_create failed.");
+		return 0;
+	    }
+	    if ((p = mm_region_alloc(regions[trace->ops[i].region], size)) == NULL) {
+		malloc_error(tracenum, i, "mm_region_alloc failed.");
+		return 0;
+	    }
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case REGION_RESET: /* mm_region_reset */
+
+	    /* The blocks of the region must be intact until the reset */
+	    for (j = 0; j < size; j++) {
+		int id = trace->region_ids[index + j];
+		int k;
+		p = trace->blocks[id];
+		for (k = 0; k < trace->block_sizes[id]; k++) {
+		    if ((unsigned char)p[k] != (id & 0xFF)) {
+			malloc_error(tracenum, i, "mm_region_alloc block was "
+				     "overwritten before the reset");
+			return 0;
+		    }
+		}
+		remove_range(ranges, p);
+	    }
+	    if (regions[trace->ops[i].region] != NULL)
+		mm_region_reset(regions[trace->ops[i].region]);
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
@@ -697,7 +1188,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 {   
-    int i;
+    int i, j;
     int index;
     int size, newsize, oldsize;
     int max_total_size = 0;
@@ -707,8 +1198,9 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
-    if (mm_init() < 0)
+    if (init_mm(trace) < 0)
 	app_error("mm_init failed in eval_mm_util");
+    reset_regions(trace);
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
@@ -717,7 +1209,9 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    p = (alloc_hints != NULL) ? mm_malloc_hint(size, alloc_hints[index]) :
+		mm_malloc(size);
+	    if (p == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -768,6 +1262,28 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    break;
 
+        case REGION_ALLOC: /* mm_region_alloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+
+	    if (get_region(trace->ops[i].region) == NULL ||
+		(p = mm_region_alloc(regions[trace->ops[i].region], size)) == NULL)
+		app_error("mm_region_alloc failed in eval_mm_util");
+
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+        case REGION_RESET: /* mm_region_reset */
+	    for (j = 0; j < trace->ops[i].size; j++)
+		total_size -= trace->block_sizes[trace->region_ids[trace->ops[i].index + j]];
+	    if (regions[trace->ops[i].region] != NULL)
+		mm_region_reset(regions[trace->ops[i].region]);
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_util");
 
@@ -781,18 +1297,35 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
  *    to measure the running time of the mm malloc package.
+ *    With -i, the trace is replayed several times over the same heap,
+ *    emptied by mm_reset in between.
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
-    char *p, *newp, *oldp, *block;
+    int iter;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
-    if (mm_init() < 0) 
+    if (init_mm(trace) < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
+    for (iter = 0; iter < replay_iterations; iter++) {
+	if (iter > 0)
+	    mm_reset(1);
+	reset_regions(trace);
+	replay_mm(trace);
+    }
+}
+
+/*
+ * replay_mm - Run every request of the trace with the mm package
+ */
+static void replay_mm(trace_t *trace)
+{
+    int i, index, size, newsize;
+    char *p, *newp, *oldp, *block;
+
     /* Interpret each trace request */
     for (i = 0;  i < trace->num_ops;  i++)
         switch (trace->ops[i].type) {
@@ -809,8 +1342,12 @@ static void eval_mm_speed(void *ptr)
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
+	    if (time_reallocs)
+		start_counter();
             if ((newp = mm_realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
+	    if (time_reallocs)
+		realloc_cycles += get_counter();
             trace->blocks[index] = newp;
             break;
 
@@ -820,36 +1357,1040 @@ static void eval_mm_speed(void *ptr)
             mm_free(block);
             break;
 
+        case REGION_ALLOC: /* mm_region_alloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if (get_region(trace->ops[i].region) == NULL ||
+		(p = mm_region_alloc(regions[trace->ops[i].region], size)) == NULL)
+		app_error("mm_region_alloc error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
+        case REGION_RESET: /* mm_region_reset */
+	    if (regions[trace->ops[i].region] != NULL)
+		mm_region_reset(regions[trace->ops[i].region]);
+            break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 }
 
 /*
- * eval_libc_valid - We run this function to make sure that the
- *    libc malloc can run to completion on the set of traces.
- *    We'll be conservative and terminate if any libc malloc call fails.
+ * eval_mm_probes - Replay the trace once under the cycle counter, and
+ *    count the blocks that mm.c examined to find free space meanwhile.
+ *    On large heaps most of these probes miss in the cache, so
+ *    cycles/probe shows how much prefetching (MM_PREFETCH) helps.
+ */
+static void eval_mm_probes(speed_t *speed_params, stats_t *stats)
+{
+    unsigned long probes = mm_probes();
+
+    start_counter();
+    eval_mm_speed(speed_params);
+    stats->cycles = get_counter();
+    stats->probes = (double)(mm_probes() - probes);
+}
+
+/*
+ * eval_mm_reallocs - Replay the trace once, counting the cycles spent
+ *    in mm_realloc and the shrinking reallocs that split their block
+ */
+static void eval_mm_reallocs(speed_t *speed_params, stats_t *stats)
+{
+    trace_t *trace = speed_params->trace;
+    unsigned long shrinks = mm_realloc_shrinks();
+    int i;
+
+    stats->reallocs = 0;
+    for (i = 0; i < trace->num_ops; i++)
+	if (trace->ops[i].type == REALLOC)
+	    stats->reallocs++;
+    stats->reallocs *= replay_iterations;
+
+    time_reallocs = 1;
+    realloc_cycles = 0;
+    eval_mm_speed(speed_params);
+    time_reallocs = 0;
+    stats->realloc_cycles = realloc_cycles;
+    stats->shrinks = (double)(mm_realloc_shrinks() - shrinks);
+}
+
+/*
+ * eval_mm_compact - Replay the trace through the handle API twice,
+ *    without and with a call to mm_compact every compact_period ops
+ */
+static void eval_mm_compact(trace_t *trace, int tracenum, stats_t *stats)
+{
+    stats->moved = 0;
+    stats->compact_cycles = 0;
+    replay_handles(trace, tracenum, 0, stats, 0);
+    replay_handles(trace, tracenum, compact_period, stats, 1);
+}
+
+/*
+ * replay_handles - Run the trace with mm_halloc, mm_hrealloc and
+ *    mm_hfree, calling mm_compact every period ops if period > 0.
+ *    Each block is tagged with its id while pinned, and the tag is
+ *    checked before the block is resized or freed, to catch a bad move.
  *
+ *    mm_compact gives the heap top back, so the peak utilization is
+ *    computed against the high water mark of the heap; the average
+ *    utilization is the live bytes over the heap size, averaged over
+ *    the ops.
  */
-static int eval_libc_valid(trace_t *trace, int tracenum)
+static void replay_handles(trace_t *trace, int tracenum, int period, 
+			   stats_t *stats, int slot)
 {
-    int i, newsize;
-    char *p, *newp, *oldp;
+    mm_handle_t *handles;
+    int i, j, index, size;
+    int total_size = 0, max_total_size = 0;
+    size_t heapsize, max_heapsize = 0;
+    double util_sum = 0;
+    unsigned char *p;
+
+    if ((handles = (mm_handle_t *)calloc(trace->num_ids, sizeof(mm_handle_t))) == NULL)
+	unix_error("calloc error in replay_handles");
+
+    mem_reset_brk();
+    if (init_mm(trace) < 0)
+	app_error("mm_init failed in replay_handles");
+    reset_regions(trace);
 
     for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+
         switch (trace->ops[i].type) {
 
-        case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
-		malloc_error(tracenum, i, "libc malloc failed");
-		unix_error("System message");
-	    }
-	    trace->blocks[trace->ops[i].index] = p;
+        case ALLOC: /* mm_halloc */
+	    if ((handles[index] = mm_halloc(size)) == 0)
+		app_error("mm_halloc failed in replay_handles");
+	    trace->block_sizes[index] = size;
+	    total_size += size;
 	    break;
 
-	case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-	    oldp = trace->blocks[trace->ops[i].index];
+	case REALLOC: /* mm_hrealloc */
+	case FREE: /* mm_hfree */
+	    p = mm_hpin(handles[index]);
+	    if (trace->block_sizes[index] > 0 && 
+		(p[0] != (unsigned char)index || 
+		 p[trace->block_sizes[index] - 1] != (unsigned char)index)) {
+		malloc_error(tracenum, i, "block of a handle lost its contents");
+		break;
+	    }
+	    mm_hunpin(handles[index]);
+	    total_size -= trace->block_sizes[index];
+	    if (trace->ops[i].type == FREE) {
+		mm_hfree(handles[index]);
+		break;
+	    }
+	    if (mm_hrealloc(handles[index], size) < 0)
+		app_error("mm_hrealloc failed in replay_handles");
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    break;
+
+        case REGION_ALLOC: /* mm_region_alloc, not movable */
+	    if (get_region(trace->ops[i].region) == NULL ||
+		mm_region_alloc(regions[trace->ops[i].region], size) == NULL)
+		app_error("mm_region_alloc failed in replay_handles");
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    break;
+
+        case REGION_RESET: /* mm_region_reset */
+	    for (j = 0; j < trace->ops[i].size; j++)
+		total_size -= trace->block_sizes[trace->region_ids[trace->ops[i].index + j]];
+	    if (regions[trace->ops[i].region] != NULL)
+		mm_region_reset(regions[trace->ops[i].region]);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in replay_handles");
+        }
+
+	/* tag the block, so that a move that loses it shows */
+	if ((trace->ops[i].type == ALLOC || trace->ops[i].type == REALLOC) && size > 0) {
+	    p = mm_hpin(handles[index]);
+	    p[0] = p[size - 1] = (unsigned char)index;
+	    mm_hunpin(handles[index]);
+	}
+
+	if (period > 0 && (i + 1) % period == 0) {
+	    start_counter();
+	    stats->moved += mm_compact(COMPACT_BUDGET);
+	    stats->compact_cycles += get_counter();
+	}
+
+	max_total_size = (total_size > max_total_size) ? total_size : max_total_size;
+	heapsize = mem_heapsize();
+	max_heapsize = (heapsize > max_heapsize) ? heapsize : max_heapsize;
+	if (heapsize > 0)
+	    util_sum += (double)total_size / heapsize;
+    }
+
+    stats->handle_util[slot] = (max_heapsize > 0) ? 
+	(double)max_total_size / max_heapsize : 0;
+    stats->handle_avg_util[slot] = util_sum / trace->num_ops;
+    free(handles);
+}
+
+/*
+ * eval_mm_hints - Derive the lifetime of every block from the trace,
+ *    i.e. the ops between its 'a' and its 'f' (or the end of the trace),
+ *    and measure the utilization of a replay that hints the blocks
+ *    living less than the mean lifetime as short-lived, the others as
+ *    long-lived: the gain an oracle would get from mm_malloc_hint.
+ */
+static void eval_mm_hints(trace_t *trace, int tracenum, range_t **ranges, 
+			  stats_t *stats)
+{
+    int *born, *lifetime;
+    int i, index, blocks = 0, short_lived = 0;
+    double mean = 0;
+
+    born = (int *)calloc(trace->num_ids, sizeof(int));
+    lifetime = (int *)calloc(trace->num_ids, sizeof(int));
+    alloc_hints = (int *)calloc(trace->num_ids, sizeof(int));
+    if (born == NULL || lifetime == NULL || alloc_hints == NULL)
+	unix_error("calloc error in eval_mm_hints");
+
+    for (i = 0; i < trace->num_ids; i++)
+	lifetime[i] = -1;
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	if (trace->ops[i].type == ALLOC)
+	    born[index] = i;
+	else if (trace->ops[i].type == FREE)
+	    lifetime[index] = i - born[index];
+    }
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	if (trace->ops[i].type != ALLOC)
+	    continue;
+	if (lifetime[index] < 0) /* never freed */
+	    lifetime[index] = trace->num_ops - born[index];
+	mean += lifetime[index];
+	blocks++;
+    }
+    if (blocks > 0)
+	mean /= blocks;
+
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	if (trace->ops[i].type != ALLOC)
+	    continue;
+	if (lifetime[index] < mean) {
+	    alloc_hints[index] = MM_SHORT_LIVED;
+	    short_lived++;
+	}
+	else
+	    alloc_hints[index] = MM_LONG_LIVED;
+    }
+
+    stats->short_lived = (blocks > 0) ? (double)short_lived / blocks : 0;
+    stats->hinted_util = eval_mm_util(trace, tracenum, ranges);
+
+    free(alloc_hints);
+    alloc_hints = NULL;
+    free(born);
+    free(lifetime);
+}
+
+/*
+ * find_id - Slot of a live id in the table of the streamed replay, or
+ *     NULL if it is not there. With insert, a missing id gets a slot,
+ *     and the table doubles when it gets 3/4 full.
+ */
+static id_slot_t *find_id(int id, int insert)
+{
+    unsigned int slot;
+    int i, old_capacity;
+    id_slot_t *old;
+
+    if (insert && 4 * (ids_live + 1) > 3 * ids_capacity) {
+	old = ids;
+	old_capacity = ids_capacity;
+	ids_capacity = (ids_capacity == 0) ? STREAM_IDS : 2 * ids_capacity;
+	if ((ids = (id_slot_t *)malloc(ids_capacity * sizeof(id_slot_t))) == NULL)
+	    unix_error("malloc error in find_id");
+	for (i = 0; i < ids_capacity; i++)
+	    ids[i].id = -1;
+	ids_live = 0;
+	for (i = 0; i < old_capacity; i++)
+	    if (old[i].id >= 0)
+		*find_id(old[i].id, 1) = old[i];
+	free(old);
+    }
+    if (ids_capacity == 0)
+	return NULL;
+
+    slot = ((unsigned int)id * 2654435761u) & (ids_capacity - 1);
+    while (ids[slot].id != id) {
+	if (ids[slot].id < 0) {
+	    if (!insert)
+		return NULL;
+	    ids[slot].id = id;
+	    ids_live++;
+	    break;
+	}
+	slot = (slot + 1) & (ids_capacity - 1);
+    }
+    return &ids[slot];
+}
+
+/*
+ * remove_id - Free the slot of an id, moving back the ids after it
+ *     that could not take their own slot
+ */
+static void remove_id(id_slot_t *slot)
+{
+    unsigned int hole = slot - ids, next, home;
+
+    ids_live--;
+    for (next = (hole + 1) & (ids_capacity - 1); ids[next].id >= 0; 
+	 next = (next + 1) & (ids_capacity - 1)) {
+	home = ((unsigned int)ids[next].id * 2654435761u) & (ids_capacity - 1);
+	/* the id at next may fill the hole if its home is not in (hole, next] */
+	if (((next - home) & (ids_capacity - 1)) >= ((next - hole) & (ids_capacity - 1))) {
+	    ids[hole] = ids[next];
+	    hole = next;
+	}
+    }
+    ids[hole].id = -1;
+}
+
+/*
+ * stream_reader - Background thread of a streamed replay: fill each
+ *     buffer as soon as the replay has emptied it, until the trace ends
+ */
+static void *stream_reader(void *arg)
+{
+    stream_t *s = (stream_t *)arg;
+    int b = 0, count;
+
+    do {
+	pthread_mutex_lock(&s->lock);
+	while (s->count[b] >= 0)
+	    pthread_cond_wait(&s->changed, &s->lock);
+	pthread_mutex_unlock(&s->lock);
+
+	count = read_trace_stream(s->stream, s->chunk[b], STREAM_CHUNK_OPS);
+
+	pthread_mutex_lock(&s->lock);
+	s->count[b] = count;
+	pthread_cond_broadcast(&s->changed);
+	pthread_mutex_unlock(&s->lock);
+	b = 1 - b;
+    } while (count > 0);
+    return NULL;
+}
+
+/*
+ * seconds - Wall clock time, in seconds
+ */
+static double seconds(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*
+ * eval_mm_stream - Replay a trace once while a background thread reads
+ *     it by chunks, with a sparse table of the live ids instead of
+ *     per-id arrays. The time the replay waits for a chunk is not part
+ *     of its time; it is reported apart.
+ */
+static void eval_mm_stream(char *filename, int tracenum, stats_t *stats)
+{
+    stream_t s;
+    trace_t header;
+    pthread_t reader;
+    mm_region_t **stream_regions = NULL;
+    long *region_bytes = NULL;  /* live bytes of each region */
+    int num_stream_regions = 0;
+    id_slot_t *slot;
+    traceop_t *op;
+    double start, wait, replay = 0, stall = 0;
+    long total_size = 0, max_total_size = 0;
+    int b = 0, i, r;
+    char *p;
+
+    s.stream = open_trace_stream(tracedir, filename, &header);
+    if ((s.chunk[0] = (traceop_t *)malloc(STREAM_CHUNK_OPS * sizeof(traceop_t))) == NULL ||
+	(s.chunk[1] = (traceop_t *)malloc(STREAM_CHUNK_OPS * sizeof(traceop_t))) == NULL)
+	unix_error("malloc error in eval_mm_stream");
+    s.count[0] = s.count[1] = -1;
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.changed, NULL);
+
+    mem_reset_brk();
+    if (init_mm(&header) < 0)
+	app_error("mm_init failed in eval_mm_stream");
+    if (pthread_create(&reader, NULL, stream_reader, &s) != 0)
+	unix_error("pthread_create failed in eval_mm_stream");
+
+    stats->ops = 0;
+    for (;;) {
+	wait = seconds();
+	pthread_mutex_lock(&s.lock);
+	while (s.count[b] < 0)
+	    pthread_cond_wait(&s.changed, &s.lock);
+	pthread_mutex_unlock(&s.lock);
+	start = seconds();
+	stall += start - wait;
+	if (s.count[b] == 0)
+	    break;
+
+	for (i = 0; i < s.count[b]; i++) {
+	    op = &s.chunk[b][i];
+	    switch (op->type) {
+	    case ALLOC:
+		if ((p = mm_malloc(op->size)) == NULL)
+		    app_error("mm_malloc failed in eval_mm_stream");
+		slot = find_id(op->index, 1);
+		slot->p = p;
+		slot->size = op->size;
+		total_size += op->size;
+		break;
+	    case REALLOC:
+		if ((slot = find_id(op->index, 0)) == NULL)
+		    malloc_error(tracenum, (int)stats->ops + i, "realloc of an id not live");
+		else if ((slot->p = mm_realloc(slot->p, op->size)) == NULL)
+		    app_error("mm_realloc failed in eval_mm_stream");
+		else {
+		    total_size += op->size - slot->size;
+		    slot->size = op->size;
+		}
+		break;
+	    case FREE:
+		if ((slot = find_id(op->index, 0)) == NULL)
+		    malloc_error(tracenum, (int)stats->ops + i, "free of an id not live");
+		else {
+		    mm_free(slot->p);
+		    total_size -= slot->size;
+		    remove_id(slot);
+		}
+		break;
+	    case REGION_ALLOC:
+		/* region blocks are never referenced again: only their bytes count */
+		if (op->region >= num_stream_regions) {
+		    r = num_stream_regions;
+		    num_stream_regions = 2 * op->region + 1;
+		    if ((stream_regions = (mm_region_t **)realloc(stream_regions, 
+			num_stream_regions * sizeof(mm_region_t *))) == NULL)
+			unix_error("realloc error in eval_mm_stream");
+		    if ((region_bytes = (long *)realloc(region_bytes, 
+			num_stream_regions * sizeof(long))) == NULL)
+			unix_error("realloc error in eval_mm_stream");
+		    for (; r < num_stream_regions; r++) {
+			stream_regions[r] = NULL;
+			region_bytes[r] = 0;
+		    }
+		}
+		if ((stream_regions[op->region] == NULL &&
+		     (stream_regions[op->region] = mm_region_create(0)) == NULL) ||
+		    mm_region_alloc(stream_regions[op->region], op->size) == NULL)
+		    app_error("mm_region_alloc failed in eval_mm_stream");
+		region_bytes[op->region] += op->size;
+		total_size += op->size;
+		break;
+	    case REGION_RESET:
+		if (op->region < num_stream_regions && stream_regions[op->region] != NULL) {
+		    mm_region_reset(stream_regions[op->region]);
+		    total_size -= region_bytes[op->region];
+		    region_bytes[op->region] = 0;
+		}
+		break;
+	    }
+	    if (total_size > max_total_size)
+		max_total_size = total_size;
+	}
+	stats->ops += s.count[b];
+	replay += seconds() - start;
+
+	/* give the buffer back to the reader */
+	pthread_mutex_lock(&s.lock);
+	s.count[b] = -1;
+	pthread_cond_broadcast(&s.changed);
+	pthread_mutex_unlock(&s.lock);
+	b = 1 - b;
+    }
+
+    pthread_join(reader, NULL);
+    close_trace_stream(s.stream);
+    free(s.chunk[0]);
+    free(s.chunk[1]);
+    free(stream_regions);
+    free(region_bytes);
+    free(ids);
+    ids = NULL;
+    ids_capacity = ids_live = 0;
+
+    stats->valid = (errors == 0);
+    stats->secs = replay;
+    stats->stall_secs = stall;
+    stats->util = (double)max_total_size / mem_heapsize();
+}
+
+/*
+ * wait_turn - Wait until seq ops of the thread-tagged replay are done
+ *     on block id
+ */
+static void wait_turn(int *stage, int id, int seq)
+{
+    int spins = 0;
+
+    while (__atomic_load_n(&stage[id], __ATOMIC_ACQUIRE) != seq)
+	if (++spins >= THREAD_SPINS) {
+	    sched_yield();
+	    spins = 0;
+	}
+}
+
+/*
+ * replay_thread - One thread of a threaded replay: THREAD_REPS replays
+ *     of the trace (or of the ops of its tag), from the moment every
+ *     thread is ready. With mm, the thread works in a heap of its own,
+ *     emptied between the replays; the blocks of the other threads go
+ *     back to their heap with mm_heap_free_remote.
+ */
+static void *replay_thread(void *arg)
+{
+    replayer_t *r = (replayer_t *)arg;
+    trace_t *trace = r->trace;
+    tags_t *tags = r->tags;
+    mm_heap_t *own = NULL;
+    int i, j, k, first, last, rep, index, size, region, remote;
+    char *p;
+
+    if (!r->use_libc) {
+	if ((own = mm_heap_create(MAX_HEAP)) == NULL)
+	    app_error("mm_heap_create failed in replay_thread");
+	mm_heap_select(own);
+	if (tags != NULL)
+	    tags->heaps[r->thread] = own;
+    }
+    first = (tags != NULL) ? tags->first[r->thread] : 0;
+    last = (tags != NULL) ? tags->first[r->thread + 1] : trace->num_ops;
+    r->ops = (double)(last - first) * THREAD_REPS;
+
+    pthread_barrier_wait(r->ready);
+    r->start = seconds();
+    for (rep = 0; rep < THREAD_REPS; rep++) {
+	if (rep > 0) {
+	    /* no block may be freed remotely while the heaps are emptied */
+	    if (tags != NULL)
+		pthread_barrier_wait(r->ready);
+	    if (own != NULL)
+		mm_reset(1);
+	    /* the regions died with their chunks */
+	    for (j = 0; j < trace->num_regions; j++)
+		r->regions[j] = NULL;
+	    if (tags != NULL) {
+		if (r->thread == 0)
+		    memset(tags->stage, 0, trace->num_ids * sizeof(int));
+		pthread_barrier_wait(r->ready);
+	    }
+	}
+	for (k = first; k < last; k++) {
+	    i = (tags != NULL) ? tags->order[k] : k;
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    region = trace->ops[i].region;
+	    remote = 0;
+	    if (tags != NULL && trace->ops[i].type != REGION_RESET) {
+		wait_turn(tags->stage, index, tags->seq[i]);
+		remote = (own != NULL && tags->owner[index] != r->thread);
+	    }
+	    switch (trace->ops[i].type) {
+	    case ALLOC:
+		p = r->use_libc ? malloc(size) : mm_malloc(size);
+		if (p == NULL)
+		    app_error("malloc failed in replay_thread");
+		r->blocks[index] = p;
+		break;
+	    case REALLOC:
+		if (remote) {
+		    /* the block moves to this thread's heap */
+		    if ((p = mm_malloc(size)) == NULL)
+			app_error("malloc failed in replay_thread");
+		    memcpy(p, r->blocks[index], (size < tags->sizes[index]) ? size : tags->sizes[index]);
+		    mm_heap_free_remote(tags->heaps[tags->owner[index]], r->blocks[index]);
+		}
+		else
+		    p = r->use_libc ? realloc(r->blocks[index], size) : 
+			mm_realloc(r->blocks[index], size);
+		if (p == NULL)
+		    app_error("realloc failed in replay_thread");
+		r->blocks[index] = p;
+		break;
+	    case FREE:
+		if (r->use_libc)
+		    free(r->blocks[index]);
+		else if (remote)
+		    mm_heap_free_remote(tags->heaps[tags->owner[index]], r->blocks[index]);
+		else
+		    mm_free(r->blocks[index]);
+		break;
+	    case REGION_ALLOC: /* malloc with libc, as in eval_libc_speed */
+		if (r->use_libc)
+		    p = malloc(size);
+		else if (r->regions[region] == NULL &&
+			 (r->regions[region] = mm_region_create(0)) == NULL)
+		    p = NULL;
+		else
+		    p = mm_region_alloc(r->regions[region], size);
+		if (p == NULL)
+		    app_error("region alloc failed in replay_thread");
+		r->blocks[index] = p;
+		break;
+	    case REGION_RESET:
+		if (r->use_libc) {
+		    for (j = 0; j < size; j++)
+			free(r->blocks[trace->region_ids[index + j]]);
+		}
+		else if (r->regions[region] != NULL)
+		    mm_region_reset(r->regions[region]);
+		break;
+	    }
+	    if (tags != NULL && trace->ops[i].type != REGION_RESET) {
+		tags->owner[index] = r->thread;
+		tags->sizes[index] = size;
+		__atomic_store_n(&tags->stage[index], tags->seq[i] + 1, __ATOMIC_RELEASE);
+	    }
+	}
+    }
+    r->secs = seconds() - r->start;
+
+    if (own != NULL) {
+	/* the other threads may still give blocks back to this heap */
+	if (tags != NULL)
+	    pthread_barrier_wait(r->ready);
+	mm_heap_select(NULL);
+	mm_heap_destroy(own);
+    }
+    return NULL;
+}
+
+/*
+ * new_tags - Split a thread-tagged trace by thread, and rank the ops
+ *     of each id, for replay_thread. *remote gets the number of frees
+ *     and reallocs of a block allocated by another thread.
+ */
+static tags_t *new_tags(trace_t *trace, double *remote)
+{
+    tags_t *tags;
+    int *rank, *region_thread;
+    int i, t, n = trace->num_threads;
+
+    if ((tags = (tags_t *)calloc(1, sizeof(tags_t))) == NULL ||
+	(tags->order = (int *)malloc((trace->num_ops + 1) * sizeof(int))) == NULL ||
+	(tags->first = (int *)calloc(n + 1, sizeof(int))) == NULL ||
+	(tags->seq = (int *)malloc((trace->num_ops + 1) * sizeof(int))) == NULL ||
+	(tags->stage = (int *)calloc(trace->num_ids + 1, sizeof(int))) == NULL ||
+	(tags->owner = (int *)calloc(trace->num_ids + 1, sizeof(int))) == NULL ||
+	(tags->sizes = (int *)calloc(trace->num_ids + 1, sizeof(int))) == NULL ||
+	(tags->blocks = (char **)calloc(trace->num_ids + 1, sizeof(char *))) == NULL ||
+	(tags->heaps = (mm_heap_t **)calloc(n, sizeof(mm_heap_t *))) == NULL ||
+	(rank = (int *)calloc(trace->num_ids + 1, sizeof(int))) == NULL ||
+	(region_thread = (int *)malloc((trace->num_regions + 1) * sizeof(int))) == NULL)
+	unix_error("malloc error in new_tags");
+    for (i = 0; i < trace->num_regions; i++)
+	region_thread[i] = -1;
+
+    /* counting sort of the ops by thread, keeping their order */
+    for (i = 0; i < trace->num_ops; i++)
+	tags->first[trace->ops[i].thread + 1]++;
+    for (t = 0; t < n; t++)
+	tags->first[t + 1] += tags->first[t];
+    *remote = 0;
+    for (i = 0; i < trace->num_ops; i++) {
+	traceop_t *op = &trace->ops[i];
+	tags->order[tags->first[op->thread]++] = i;
+	if (op->type == REGION_ALLOC || op->type == REGION_RESET) {
+	    /* a region is not shared: its record lives in one heap */
+	    if (region_thread[op->region] >= 0 && region_thread[op->region] != op->thread)
+		app_error("a region is used by several threads in the trace");
+	    region_thread[op->region] = op->thread;
+	}
+	if (op->type == REGION_RESET)
+	    continue;
+	if ((op->type == FREE || op->type == REALLOC) && tags->owner[op->index] != op->thread)
+	    (*remote)++;
+	tags->owner[op->index] = op->thread;
+	tags->seq[i] = rank[op->index]++;
+    }
+    for (t = n; t > 0; t--)
+	tags->first[t] = tags->first[t - 1];
+    tags->first[0] = 0;
+
+    free(rank);
+    free(region_thread);
+    return tags;
+}
+
+/*
+ * free_tags - Release what new_tags made
+ */
+static void free_tags(tags_t *tags)
+{
+    free(tags->order);
+    free(tags->first);
+    free(tags->seq);
+    free(tags->stage);
+    free(tags->owner);
+    free(tags->sizes);
+    free(tags->blocks);
+    free(tags->heaps);
+    free(tags);
+}
+
+/*
+ * run_threads - Replay a trace in n threads at once: n copies of it,
+ *     or the n threads of a thread-tagged trace. Returns the wall clock
+ *     secs from the first start to the last end; the secs and the ops
+ *     of each thread go to secs[] and ops[].
+ */
+static double run_threads(trace_t *trace, int use_libc, int n, tags_t *tags,
+			  double *secs, double *ops)
+{
+    replayer_t *r;
+    pthread_t *tids;
+    pthread_barrier_t ready;
+    double first = 0, last = 0;
+    int i;
+
+    r = (replayer_t *)calloc(n, sizeof(replayer_t));
+    tids = (pthread_t *)malloc(n * sizeof(pthread_t));
+    if (r == NULL || tids == NULL)
+	unix_error("malloc error in run_threads");
+    pthread_barrier_init(&ready, NULL, n);
+    if (tags != NULL)
+	memset(tags->stage, 0, trace->num_ids * sizeof(int));
+
+    for (i = 0; i < n; i++) {
+	r[i].trace = trace;
+	r[i].thread = i;
+	r[i].use_libc = use_libc;
+	r[i].tags = tags;
+	r[i].ready = &ready;
+	if (tags != NULL)
+	    r[i].blocks = tags->blocks; /* ids pass from thread to thread */
+	else if ((r[i].blocks = (char **)calloc(trace->num_ids + 1, sizeof(char *))) == NULL)
+	    unix_error("calloc error in run_threads");
+	r[i].regions = (mm_region_t **)calloc(trace->num_regions + 1, sizeof(mm_region_t *));
+	if (r[i].regions == NULL)
+	    unix_error("calloc error in run_threads");
+    }
+    for (i = 0; i < n; i++)
+	if (pthread_create(&tids[i], NULL, replay_thread, &r[i]) != 0)
+	    unix_error("pthread_create failed in run_threads");
+    for (i = 0; i < n; i++) {
+	pthread_join(tids[i], NULL);
+	if (i == 0 || r[i].start < first)
+	    first = r[i].start;
+	if (i == 0 || r[i].start + r[i].secs > last)
+	    last = r[i].start + r[i].secs;
+	if (secs != NULL)
+	    secs[i] = r[i].secs;
+	if (ops != NULL)
+	    ops[i] = r[i].ops;
+	if (tags == NULL)
+	    free(r[i].blocks);
+	free(r[i].regions);
+    }
+
+    pthread_barrier_destroy(&ready);
+    free(r);
+    free(tids);
+    return last - first;
+}
+
+/*
+ * eval_threads - Time THREAD_REPS replays of a trace by one thread
+ *     alone, then by num_threads threads at once. A thread-tagged
+ *     trace is replayed by the threads of its tags instead, sharing
+ *     its blocks, and alone without its tags.
+ */
+static void eval_threads(trace_t *trace, int use_libc, stats_t *stats)
+{
+    tags_t *tags = NULL;
+
+    stats->remote = 0;
+    stats->threads = num_threads;
+    if (trace->num_threads > 1) {
+	tags = new_tags(trace, &stats->remote);
+	stats->threads = trace->num_threads;
+    }
+    if ((stats->thread_secs = (double *)malloc(stats->threads * sizeof(double))) == NULL ||
+	(stats->thread_ops = (double *)malloc(stats->threads * sizeof(double))) == NULL)
+	unix_error("malloc error in eval_threads");
+    stats->ops = (double)trace->num_ops * THREAD_REPS;
+    stats->solo_secs = run_threads(trace, use_libc, 1, NULL, NULL, NULL);
+    stats->secs = run_threads(trace, use_libc, stats->threads, tags, 
+			      stats->thread_secs, stats->thread_ops);
+    stats->valid = 1;
+    if (tags != NULL)
+	free_tags(tags);
+}
+
+/*
+ * now_ns - Monotonic time in ns, for the latency of single calls
+ */
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * hist_add - Count a value in a latency histogram
+ */
+static void hist_add(hist_t *hist, unsigned long long value)
+{
+    int shift, bucket;
+
+    if (value < (1ULL << HIST_SUB_BITS))
+	bucket = (int)value;
+    else {
+	/* value >> shift keeps the HIST_SUB_BITS+1 top bits of the value */
+	shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+	bucket = ((shift + 1) << HIST_SUB_BITS) + 
+	    (int)((value >> shift) - (1ULL << HIST_SUB_BITS));
+    }
+    hist->count[bucket]++;
+    hist->total++;
+    if (value > hist->max)
+	hist->max = value;
+}
+
+/*
+ * hist_quantile - The value below which a fraction q of the values
+ *     fall, rounded up to the top of its bucket (or to the max)
+ */
+static unsigned long long hist_quantile(hist_t *hist, double q)
+{
+    unsigned long seen = 0, rank = (unsigned long)(q * hist->total);
+    unsigned long long value;
+    int bucket, shift, top;
+
+    if (rank >= hist->total)
+	return hist->max;
+    for (bucket = 0; bucket < HIST_BUCKETS; bucket++) {
+	seen += hist->count[bucket];
+	if (seen > rank)
+	    break;
+    }
+    if (bucket < (1 << HIST_SUB_BITS))
+	return bucket;
+    shift = (bucket >> HIST_SUB_BITS) - 1;
+    top = (bucket & ((1 << HIST_SUB_BITS) - 1)) + (1 << HIST_SUB_BITS);
+    value = (((unsigned long long)top + 1) << shift) - 1;
+    return (value < hist->max) ? value : hist->max;
+}
+
+/*
+ * calibrate_timer - Measure the median cost of a pair of now_ns calls,
+ *     which every latency includes
+ */
+static void calibrate_timer(void)
+{
+    hist_t *hist;
+    unsigned long long start;
+    int i;
+
+    if ((hist = (hist_t *)calloc(1, sizeof(hist_t))) == NULL)
+	unix_error("calloc error in calibrate_timer");
+    for (i = 0; i < TIMER_CALIBRATION; i++) {
+	start = now_ns();
+	hist_add(hist, now_ns() - start);
+    }
+    timer_overhead = hist_quantile(hist, 0.5);
+    free(hist);
+}
+
+/*
+ * record_latency - Count the latency of a call, timer cost taken off,
+ *     in the histogram of its type and size band
+ */
+static void record_latency(int type, int size, unsigned long long ns)
+{
+    int band = 0;
+
+    while (band < LATENCY_BANDS - 1 && size > band_limits[band])
+	band++;
+    hist_add(&latency[type][band], (ns > timer_overhead) ? ns - timer_overhead : 0);
+}
+
+/*
+ * eval_mm_latency - Replay the trace (-i times), timing each call to
+ *     mm_malloc, mm_free and mm_realloc on its own. Region requests
+ *     are replayed, but not timed.
+ */
+static void eval_mm_latency(trace_t *trace)
+{
+    int i, iter, index, size;
+    unsigned long long start, end;
+    char *p;
+
+    mem_reset_brk();
+    if (init_mm(trace) < 0)
+	app_error("mm_init failed in eval_mm_latency");
+
+    for (iter = 0; iter < replay_iterations; iter++) {
+	if (iter > 0)
+	    mm_reset(1);
+	reset_regions(trace);
+	for (i = 0; i < trace->num_ops; i++) {
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    switch (trace->ops[i].type) {
+	    case ALLOC:
+		start = now_ns();
+		p = mm_malloc(size);
+		end = now_ns();
+		if (p == NULL)
+		    app_error("mm_malloc failed in eval_mm_latency");
+		record_latency(ALLOC, size, end - start);
+		trace->blocks[index] = p;
+		trace->block_sizes[index] = size;
+		break;
+	    case REALLOC:
+		start = now_ns();
+		p = mm_realloc(trace->blocks[index], size);
+		end = now_ns();
+		if (p == NULL)
+		    app_error("mm_realloc failed in eval_mm_latency");
+		record_latency(REALLOC, size, end - start);
+		trace->blocks[index] = p;
+		trace->block_sizes[index] = size;
+		break;
+	    case FREE:
+		start = now_ns();
+		mm_free(trace->blocks[index]);
+		end = now_ns();
+		record_latency(FREE, trace->block_sizes[index], end - start);
+		break;
+	    case REGION_ALLOC:
+		if (get_region(trace->ops[i].region) == NULL ||
+		    mm_region_alloc(regions[trace->ops[i].region], size) == NULL)
+		    app_error("mm_region_alloc failed in eval_mm_latency");
+		break;
+	    case REGION_RESET:
+		if (regions[trace->ops[i].region] != NULL)
+		    mm_region_reset(regions[trace->ops[i].region]);
+		break;
+	    }
+	}
+    }
+}
+
+/*
+ * time_trace - Time the replay of a trace stats->runs times with fsecs,
+ *     keeping the mean and the standard deviation of the timings
+ */
+static void time_trace(fsecs_test_funct f, speed_t *speed_params, stats_t *stats)
+{
+    double t, sum = 0, squares = 0;
+    int run;
+
+    for (run = 0; run < stats->runs; run++) {
+	t = fsecs(f, speed_params);
+	sum += t;
+	squares += t * t;
+    }
+    stats->secs = sum / stats->runs;
+    stats->secs_sd = 0;
+    if (stats->runs > 1 && squares > sum * sum / stats->runs)
+	stats->secs_sd = sqrt((squares - sum * sum / stats->runs) / (stats->runs - 1));
+}
+
+/*
+ * eval_realloc_sweep - Time reallocs that must move their block, for
+ *    payloads from SWEEP_MIN to SWEEP_MAX bytes, copied by memcpy and
+ *    by the non-temporal kernel of mm.c
+ */
+static void eval_realloc_sweep(void)
+{
+    int size;
+    double plain, stream;
+    size_t threshold = mm_set_copy_threshold(0);
+
+    printf("%10s%14s%14s\n", "size(KB)", "memcpy cyc/B", "kernel cyc/B");
+    for (size = SWEEP_MIN; size <= SWEEP_MAX; size *= 2) {
+	plain = time_realloc_move(size, (size_t)-1);
+	stream = time_realloc_move(size, 0);
+	printf("%10d%14.3f%14.3f\n", size >> 10, plain / size, stream / size);
+    }
+    mm_set_copy_threshold(threshold);
+}
+
+/*
+ * time_realloc_move - Fastest of SWEEP_REPS reallocs that move a block
+ *    of size bytes, realloc moves of threshold bytes and more using the
+ *    non-temporal kernel
+ */
+static double time_realloc_move(int size, size_t threshold)
+{
+    int rep, i;
+    double cycles, best = -1;
+    char *p;
+
+    mm_set_copy_threshold(threshold);
+    for (rep = 0; rep < SWEEP_REPS; rep++) {
+	mem_reset_brk();
+	if (mm_init() < 0)
+	    app_error("mm_init failed in time_realloc_move");
+	if ((p = mm_malloc(size)) == NULL || mm_malloc(1) == NULL)
+	    app_error("mm_malloc failed in time_realloc_move");
+	memset(p, rep, size);
+
+	/* the 1-byte block behind p keeps it from growing in place */
+	start_counter();
+	if ((p = mm_realloc(p, size + ALIGNMENT)) == NULL)
+	    app_error("mm_realloc failed in time_realloc_move");
+	cycles = get_counter();
+	if (best < 0 || cycles < best)
+	    best = cycles;
+
+	for (i = 0; i < size; i++)
+	    if (p[i] != (char)rep)
+		app_error("mm_realloc lost the payload in time_realloc_move");
+    }
+    return best;
+}
+
+/*
+ * eval_libc_valid - We run this function to make sure that the
+ *    libc malloc can run to completion on the set of traces.
+ *    We'll be conservative and terminate if any libc malloc call fails.
+ *
+ */
+static int eval_libc_valid(trace_t *trace, int tracenum)
+{
+    int i, j, newsize;
+    char *p, *newp, *oldp;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* malloc */
+	    if ((p = malloc(trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc malloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	case REALLOC: /* realloc */
+            newsize = trace->ops[i].size;
+	    oldp = trace->blocks[trace->ops[i].index];
 	    if ((newp = realloc(oldp, newsize)) == NULL) {
 		malloc_error(tracenum, i, "libc realloc failed");
 		unix_error("System message");
@@ -861,6 +2402,19 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    free(trace->blocks[trace->ops[i].index]);
 	    break;
 
+        case REGION_ALLOC: /* malloc, libc has no regions */
+	    if ((p = malloc(trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc malloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+        case REGION_RESET: /* free every block of the region */
+	    for (j = 0; j < trace->ops[i].size; j++)
+		free(trace->blocks[trace->region_ids[trace->ops[i].index + j]]);
+	    break;
+
 	default:
 	    app_error("invalid operation type  in eval_libc_valid");
 	}
@@ -876,7 +2430,7 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
  */
 static void eval_libc_speed(void *ptr)
 {
-    int i;
+    int i, j;
     int index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
@@ -906,6 +2460,19 @@ static void eval_libc_speed(void *ptr)
 	    block = trace->blocks[index];
 	    free(block);
 	    break;
+
+        case REGION_ALLOC: /* malloc, libc has no regions */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((p = malloc(size)) == NULL)
+		unix_error("malloc failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
+        case REGION_RESET: /* free every block of the region */
+	    for (j = 0; j < trace->ops[i].size; j++)
+		free(trace->blocks[trace->region_ids[trace->ops[i].index + j]]);
+	    break;
 	}
     }
 }
@@ -972,6 +2539,366 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printprobes - prints the cost of the free space search for mm malloc
+ */
+static void printprobes(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%12s%10s%10s%14s\n",
+	   "trace", "probes", "probes/op", "cycles/op", "cycles/probe");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%15.0f%10.1f%10.0f%14.2f\n",
+		   i,
+		   stats[i].probes,
+		   stats[i].probes/stats[i].ops,
+		   stats[i].cycles/stats[i].ops,
+		   (stats[i].probes > 0) ? stats[i].cycles/stats[i].probes : 0.0);
+	}
+	else {
+	    printf("%2d%15s%10s%10s%14s\n", i, "-", "-", "-", "-");
+	}
+    }
+}
+
+/*
+ * printreallocs - prints the cost of mm_realloc, next to the utilization
+ */
+static void printreallocs(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%10s%10s%16s%7s\n",
+	   "trace", "reallocs", "shrinks", "cycles/realloc", "util");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%13.0f%10.0f%16.0f%6.0f%%\n",
+		   i,
+		   stats[i].reallocs,
+		   stats[i].shrinks,
+		   (stats[i].reallocs > 0) ?
+		   stats[i].realloc_cycles/stats[i].reallocs : 0.0,
+		   stats[i].util*100.0);
+	}
+	else {
+	    printf("%2d%13s%10s%16s%7s\n", i, "-", "-", "-", "-");
+	}
+    }
+}
+
+/*
+ * printcompact - prints the utilization of the handle replays, and
+ *    the cost of mm_compact per MB it slid
+ */
+static void printcompact(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%7s%9s%7s%9s%10s%12s\n",
+	   "trace", "util", "util+c", "avg", "avg+c", "MB moved", "cycles/MB");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%9.0f%%%8.0f%%%6.0f%%%8.0f%%%10.2f%12.0f\n",
+		   i,
+		   stats[i].handle_util[0]*100.0,
+		   stats[i].handle_util[1]*100.0,
+		   stats[i].handle_avg_util[0]*100.0,
+		   stats[i].handle_avg_util[1]*100.0,
+		   stats[i].moved/(1 << 20),
+		   (stats[i].moved > 0) ? 
+		   stats[i].compact_cycles/(stats[i].moved/(1 << 20)) : 0.0);
+	}
+	else {
+	    printf("%2d%10s%9s%7s%9s%10s%12s\n", i, "-", "-", "-", "-", "-", "-");
+	}
+    }
+}
+
+/*
+ * printhints - prints the utilization with and without oracle hints
+ */
+static void printhints(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%7s%9s%8s\n", "trace", "util", "hinted", "short");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%9.0f%%%8.0f%%%7.0f%%\n",
+		   i,
+		   stats[i].util*100.0,
+		   stats[i].hinted_util*100.0,
+		   stats[i].short_lived*100.0);
+	}
+	else {
+	    printf("%2d%10s%9s%8s\n", i, "-", "-", "-");
+	}
+    }
+}
+
+/*
+ * printstream - prints the results of the streamed replays
+ */
+static void printstream(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%7s%10s%10s%10s%10s\n", 
+	   "trace", "util", "ops", "secs", "Kops", "stalled");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%9.0f%%%10.0f%10.6f%10.0f%10.6f\n",
+		   i,
+		   stats[i].util*100.0,
+		   stats[i].ops,
+		   stats[i].secs,
+		   (stats[i].ops/1e3)/stats[i].secs,
+		   stats[i].stall_secs);
+	}
+	else {
+	    printf("%2d%10s%10s%10s%10s%10s\n", i, "-", "-", "-", "-", "-");
+	}
+    }
+}
+
+/*
+ * printthreads - prints the results of the threaded replays: the Kops
+ *     of a thread alone, of all the threads together, of the slowest
+ *     and fastest of them, how close together gets to n times alone,
+ *     and the frees of another thread's block in each replay
+ */
+static void printthreads(int n, stats_t *stats)
+{
+    int i, t;
+    double solo, all, ops, kops, slowest, fastest;
+
+    printf("%5s%5s%10s%10s%10s%10s%8s%8s\n", 
+	   "trace", "thr", "alone", "together", "slowest", "fastest", "scaling", "remote");
+    for (i=0; i < n; i++) {
+	solo = stats[i].ops / stats[i].solo_secs / 1e3;
+	ops = 0;
+	slowest = fastest = 0;
+	for (t = 0; t < stats[i].threads; t++) {
+	    ops += stats[i].thread_ops[t];
+	    kops = stats[i].thread_ops[t] / stats[i].thread_secs[t] / 1e3;
+	    if (t == 0 || kops < slowest)
+		slowest = kops;
+	    if (t == 0 || kops > fastest)
+		fastest = kops;
+	}
+	all = ops / stats[i].secs / 1e3;
+	printf("%2d%8d%10.0f%10.0f%10.0f%10.0f%7.0f%%%8.0f\n",
+	       i, stats[i].threads, solo, all, slowest, fastest, 
+	       100.0 * all / (stats[i].threads * solo), stats[i].remote);
+	if (verbose) {
+	    printf("%5s", "");
+	    for (t = 0; t < stats[i].threads; t++)
+		printf(" %.0f", stats[i].thread_ops[t] / stats[i].thread_secs[t] / 1e3);
+	    printf(" Kops per thread\n");
+	}
+    }
+}
+
+/*
+ * printlatency - prints the latency percentiles of each call and size
+ *     band, over all the traces
+ */
+static void printlatency(void)
+{
+    static char *names[REALLOC + 1] = {"malloc", "free", "realloc"};
+    char band_name[MAXLINE];
+    int type, band;
+    hist_t *hist;
+
+    printf("%8s%8s%10s%8s%8s%8s%8s%10s\n", 
+	   "call", "bytes", "count", "p50", "p90", "p99", "p99.9", "max");
+    for (type = ALLOC; type <= REALLOC; type++) {
+	for (band = 0; band < LATENCY_BANDS; band++) {
+	    hist = &latency[type][band];
+	    if (hist->total == 0)
+		continue;
+	    if (band < LATENCY_BANDS - 1)
+		sprintf(band_name, "<=%d", band_limits[band]);
+	    else
+		sprintf(band_name, ">%d", band_limits[band - 1]);
+	    printf("%8s%8s%10lu%8llu%8llu%8llu%8llu%10llu\n",
+		   names[type], band_name, hist->total,
+		   hist_quantile(hist, 0.5), hist_quantile(hist, 0.9),
+		   hist_quantile(hist, 0.99), hist_quantile(hist, 0.999), 
+		   hist->max);
+	}
+    }
+}
+
+/*
+ * open_report - Open a report file for writing, "-" being the stdout
+ *     kept for the report by main
+ */
+static FILE *open_report(char *path)
+{
+    FILE *out;
+
+    if (strcmp(path, "-") == 0)
+	return report_stdout;
+    if ((out = fopen(path, "w")) == NULL) {
+	sprintf(msg, "Could not open %s for the report", path);
+	unix_error(msg);
+    }
+    return out;
+}
+
+/*
+ * write_json - Write the results as JSON, one trace per line so that
+ *     read_baseline can read them back without a JSON parser
+ */
+static void write_json(FILE *out, int n, char **tracefiles, stats_t *stats,
+		       double perfindex)
+{
+    int i;
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"timer\": \"%s\",\n", fsecs_method());
+    fprintf(out, "  \"build\": {\"compiler\": \"%s\", \"date\": \"%s %s\", "
+	    "\"bits\": %d, \"copy_kernel\": \"%s\"},\n",
+	    __VERSION__, __DATE__, __TIME__, (int)(8 * sizeof(void *)), mm_copy_kernel());
+    fprintf(out, "  \"perfindex\": %.1f,\n", perfindex);
+    fprintf(out, "  \"traces\": [\n");
+    for (i = 0; i < n; i++) {
+	fprintf(out, "    {\"trace\": \"%s\", \"valid\": %d, \"errors\": %d, "
+		"\"ops\": %.0f, \"runs\": %d, \"secs\": %.9f, \"secs_sd\": %.9f, "
+		"\"kops\": %.1f, \"util\": %.6f}%s\n",
+		tracefiles[i], stats[i].valid, stats[i].errors, stats[i].ops, 
+		stats[i].runs, stats[i].secs, stats[i].secs_sd,
+		stats[i].valid ? stats[i].ops / stats[i].secs / 1e3 : 0.0,
+		stats[i].util, (i < n - 1) ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+/*
+ * write_csv - Write the results as CSV, one line per trace
+ */
+static void write_csv(FILE *out, int n, char **tracefiles, stats_t *stats)
+{
+    int i;
+
+    fprintf(out, "trace,valid,errors,ops,runs,secs,secs_sd,kops,util,timer,compiler\n");
+    for (i = 0; i < n; i++) {
+	fprintf(out, "%s,%d,%d,%.0f,%d,%.9f,%.9f,%.1f,%.6f,%s,\"%s\"\n",
+		tracefiles[i], stats[i].valid, stats[i].errors, stats[i].ops,
+		stats[i].runs, stats[i].secs, stats[i].secs_sd,
+		stats[i].valid ? stats[i].ops / stats[i].secs / 1e3 : 0.0,
+		stats[i].util, fsecs_method(), __VERSION__);
+    }
+}
+
+/*
+ * json_number - The number after "key": in a line of a JSON report,
+ *     or 0 if the key is not there
+ */
+static double json_number(char *line, char *key)
+{
+    char pattern[MAXLINE];
+    char *p;
+
+    sprintf(pattern, "\"%s\":", key);
+    if ((p = strstr(line, pattern)) == NULL)
+	return 0;
+    return atof(p + strlen(pattern));
+}
+
+/*
+ * read_baseline - Read back the traces of a report of write_json
+ */
+static baseline_t *read_baseline(char *path, int *n)
+{
+    FILE *in;
+    char line[4 * MAXLINE];
+    baseline_t *base = NULL;
+    char *name;
+    int capacity = 0;
+
+    if ((in = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open the baseline %s", path);
+	unix_error(msg);
+    }
+    *n = 0;
+    while (fgets(line, sizeof(line), in) != NULL) {
+	if ((name = strstr(line, "\"trace\": \"")) == NULL)
+	    continue;
+	if (*n == capacity) {
+	    capacity = 2 * capacity + 16;
+	    if ((base = (baseline_t *)realloc(base, capacity * sizeof(baseline_t))) == NULL)
+		unix_error("realloc error in read_baseline");
+	}
+	name += strlen("\"trace\": \"");
+	sscanf(name, "%[^\"]", base[*n].trace);
+	base[*n].valid = (int)json_number(line, "valid");
+	base[*n].runs = (int)json_number(line, "runs");
+	base[*n].kops = json_number(line, "kops");
+	base[*n].secs = json_number(line, "secs");
+	base[*n].secs_sd = json_number(line, "secs_sd");
+	base[*n].util = json_number(line, "util");
+	(*n)++;
+    }
+    fclose(in);
+    return base;
+}
+
+/*
+ * compare_baseline - Show the change of each trace since a report of
+ *     write_json, and return the number of regressions: traces that
+ *     lose more than threshold % of util, or of Kops if the slowdown
+ *     is also beyond noise (Welch's t over the runs of both sides)
+ */
+static int compare_baseline(char *path, int n, char **tracefiles, stats_t *stats, 
+			    double threshold)
+{
+    baseline_t *base;
+    int num_base, i, j, regressions = 0, slower, worse;
+    double kops, util, dkops, dutil, se, t;
+
+    base = read_baseline(path, &num_base);
+    printf("%5s%10s%10s%8s%7s%7s%7s\n", "trace", "Kops was", "Kops", "delta", 
+	   "t", "util", "delta");
+    for (i = 0; i < n; i++) {
+	for (j = 0; j < num_base && strcmp(base[j].trace, tracefiles[i]) != 0; j++)
+	    ;
+	if (j == num_base || !base[j].valid || !stats[i].valid) {
+	    printf("%5d%10s%10s%8s%7s%7s%7s  %s\n", i, "-", "-", "-", "-", "-", "-",
+		   (j == num_base) ? "not in the baseline" : 
+		   (stats[i].valid ? "invalid in the baseline" : "INVALID"));
+	    if (j < num_base && base[j].valid && !stats[i].valid)
+		regressions++;
+	    continue;
+	}
+	kops = stats[i].ops / stats[i].secs / 1e3;
+	dkops = 100.0 * (kops - base[j].kops) / base[j].kops;
+	/* util as the report rounds it, not to flag a rounding as a loss */
+	util = floor(stats[i].util * 1e6 + 0.5) / 1e6;
+	dutil = 100.0 * (util - base[j].util) / base[j].util;
+
+	/* Welch's t of the difference of the mean secs; no runs, no noise */
+	se = 0;
+	if (stats[i].runs > 1)
+	    se += stats[i].secs_sd * stats[i].secs_sd / stats[i].runs;
+	if (base[j].runs > 1)
+	    se += base[j].secs_sd * base[j].secs_sd / base[j].runs;
+	t = (se > 0) ? (stats[i].secs - base[j].secs) / sqrt(se) : HUGE_VAL;
+
+	slower = (dkops < -threshold && t > T_CRITICAL);
+	worse = (dutil < -threshold);
+	regressions += (slower || worse);
+	printf("%5d%10.0f%10.0f%7.1f%%%7.1f%6.0f%%%6.1f%%  %s%s\n", i, base[j].kops, kops, 
+	       dkops, (se > 0) ? t : 0.0, stats[i].util * 100, dutil,
+	       slower ? "SLOWER " : "", worse ? "WORSE UTIL" : "");
+    }
+    free(base);
+    return regressions;
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1004,14 +2931,39 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValLprsSCH] [-f <file>] [-t <dir>] [-i <n>] [-R <bytes>] [-c <n>] [-P <file>] [-T <n>]\n"
+	    "               [--json <file>] [--csv <file>] [--compare <file>] [--threshold <pct>]\n"
+	    "               [--timer <name>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-c <n>     Replay with handles, mm_compact every n ops.\n");
+    fprintf(stderr, "\t-C         Time realloc moves from %d KB to %d MB.\n",
+	    SWEEP_MIN >> 10, SWEEP_MAX >> 20);
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Report latency percentiles of each call, by size.\n");
+    fprintf(stderr, "\t-i <n>     Time n replays of each trace, mm_reset in between.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Report util with the trace lifetimes as hints.\n");
+    fprintf(stderr, "\t-p         Report cycles per free space probe.\n");
+    fprintf(stderr, "\t-P <file>  Write a pprof heap profile of trace n to <file>.n\n");
+    fprintf(stderr, "\t-r         Report utilization and cycles of mm_realloc.\n");
+    fprintf(stderr, "\t-R <bytes> Tails a shrinking mm_realloc keeps (hysteresis).\n");
+    fprintf(stderr, "\t-s         Start each trace with its suggested heap size.\n");
+    fprintf(stderr, "\t-S         Stream each trace by chunks, replayed once, unchecked.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Replay each trace in n threads at once (with -l, libc too);\n");
+    fprintf(stderr, "\t           a thread-tagged trace runs in the threads of its tags.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t--json <file>      Write the results as JSON (\"-\" for stdout).\n");
+    fprintf(stderr, "\t--csv <file>       Write the results as CSV (\"-\" for stdout).\n");
+    fprintf(stderr, "\t                   With \"-\", the rest of the output goes to stderr.\n");
+    fprintf(stderr, "\t--compare <file>   Compare with the JSON results of an earlier run,\n");
+    fprintf(stderr, "\t                   exit with status 2 on a regression.\n");
+    fprintf(stderr, "\t--threshold <pct>  Kops or util a trace may lose (default %.0f%%).\n",
+	    DEFAULT_THRESHOLD);
+    fprintf(stderr, "\t--timer <name>     Timing method: gettimeofday, itimer, fcyc,\n");
+    fprintf(stderr, "\t                   monotonic or rdtscp (default %s).\n", fsecs_method());
 }
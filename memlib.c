@@ -1,7 +1,15 @@
 /*
- * memlib.c - a module that simulates the memory system.  Needed because it 
- *            allows us to interleave calls from the student's malloc package 
+ * memlib.c - a module that simulates the memory system.  Needed because it
+ *            allows us to interleave calls from the student's malloc package
  *            with the system's malloc package in libc.
+ *
+ *            Each simulated heap is a mem_t. The original single-heap
+ *            interface (mem_init, mem_sbrk, ...) works on a default
+ *            instance; mem_create/mem_destroy manage additional ones.
+ *
+ *            Built with MEM_USE_MMAP, heaps are reserved with mmap
+ *            instead of libc malloc, so that the module can back a
+ *            malloc replacement (see mmpreload.c).
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,32 +22,71 @@
 #include "memlib.h"
 #include "config.h"
 
+#ifndef MEM_USE_MMAP
+#define MEM_USE_MMAP 0
+#endif
+
+/*
+ * Size of the default heap. With mmap the pages are only reserved, so
+ * we can afford much more than the driver's MAX_HEAP.
+ */
+#if MEM_USE_MMAP
+#define MEM_DEFAULT_SIZE ((size_t)1 << (sizeof(void *) == 8 ? 32 : 30))
+#else
+#define MEM_DEFAULT_SIZE MAX_HEAP
+#endif
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static mem_t default_mem;    /* heap used by the mem_xxx functions */
+
+/*
+ * mem_alloc_storage - get the storage for a heap of the given size,
+ *    or NULL
+ */
+static char *mem_alloc_storage(size_t bytes)
+{
+#if MEM_USE_MMAP
+    void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return (p == MAP_FAILED) ? NULL : (char *)p;
+#else
+    return (char *)malloc(bytes);
+#endif
+}
+
+/*
+ * mem_free_storage - give back storage from mem_alloc_storage
+ */
+static void mem_free_storage(char *p, size_t bytes)
+{
+#if MEM_USE_MMAP
+    munmap(p, bytes);
+#else
+    free(p);
+#endif
+}
 
-/* 
+/*
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
     /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
+    if ((default_mem.mem_start_brk = mem_alloc_storage(MEM_DEFAULT_SIZE)) == NULL) {
 	fprintf(stderr, "mem_init_vm: malloc error\n");
 	exit(1);
     }
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    default_mem.mem_max_addr = default_mem.mem_start_brk + MEM_DEFAULT_SIZE;  /* max legal heap address */
+    default_mem.mem_brk = default_mem.mem_start_brk;                  /* heap is empty initially */
 }
 
-/* 
+/*
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_free_storage(default_mem.mem_start_brk, MEM_DEFAULT_SIZE);
 }
 
 /*
@@ -47,25 +94,17 @@ void mem_deinit(void)
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    mem_reset_brk_in(&default_mem);
 }
 
-/* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
+/*
+ * mem_sbrk - simple model of the sbrk function. Extends the heap
  *    by incr bytes and returns the start address of the new area. In
  *    this model, the heap cannot be shrunk.
  */
-void *mem_sbrk(int incr) 
+void *mem_sbrk(int incr)
 {
-    char *old_brk = mem_brk;
-
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
-	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
-	return (void *)-1;
-    }
-    mem_brk += incr;
-    return (void *)old_brk;
+    return mem_sbrk_in(&default_mem, incr);
 }
 
 /*
@@ -73,23 +112,23 @@ void *mem_sbrk(int incr)
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return mem_heap_lo_in(&default_mem);
 }
 
-/* 
+/*
  * mem_heap_hi - return address of last heap byte
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return mem_heap_hi_in(&default_mem);
 }
 
 /*
  * mem_heapsize() - returns the heap size in bytes
  */
-size_t mem_heapsize() 
+size_t mem_heapsize()
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return mem_heapsize_in(&default_mem);
 }
 
 /*
@@ -99,3 +138,98 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_default - return the instance behind the mem_xxx functions
+ */
+mem_t *mem_default()
+{
+    return &default_mem;
+}
+
+/*
+ * mem_create - make a new, empty heap able to grow up to max_heap
+ *    bytes. The mem_t record and the heap storage come from a single
+ *    allocation, so mem_destroy releases the whole heap at once.
+ */
+mem_t *mem_create(size_t max_heap)
+{
+    mem_t *mem;
+    size_t hdr = (sizeof(mem_t) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+
+    if ((mem = (mem_t *)mem_alloc_storage(hdr + max_heap)) == NULL) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    mem->mem_start_brk = (char *)mem + hdr;
+    mem->mem_max_addr = mem->mem_start_brk + max_heap;
+    mem->mem_brk = mem->mem_start_brk;
+    return mem;
+}
+
+/*
+ * mem_destroy - release a heap made by mem_create, whatever it holds
+ */
+void mem_destroy(mem_t *mem)
+{
+    mem_free_storage((char *)mem, mem->mem_max_addr - (char *)mem);
+}
+
+/*
+ * mem_sbrk_in - mem_sbrk on a given heap
+ */
+void *mem_sbrk_in(mem_t *mem, int incr)
+{
+    char *old_brk = mem->mem_brk;
+
+    if ( (incr < 0) || ((mem->mem_brk + incr) > mem->mem_max_addr)) {
+	errno = ENOMEM;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+    mem->mem_brk += incr;
+    return (void *)old_brk;
+}
+
+/*
+ * mem_reset_brk_in - mem_reset_brk on a given heap
+ */
+void mem_reset_brk_in(mem_t *mem)
+{
+    mem->mem_brk = mem->mem_start_brk;
+}
+
+/*
+ * mem_trim_in - give back the top of a heap, so that it holds size
+ *    bytes. Unlike sbrk with a negative increment, this cannot fail:
+ *    a heap already smaller is left alone.
+ */
+void mem_trim_in(mem_t *mem, size_t size)
+{
+    if (size < (size_t)(mem->mem_brk - mem->mem_start_brk))
+	mem->mem_brk = mem->mem_start_brk + size;
+}
+
+/*
+ * mem_heap_lo_in - mem_heap_lo on a given heap
+ */
+void *mem_heap_lo_in(mem_t *mem)
+{
+    return (void *)mem->mem_start_brk;
+}
+
+/*
+ * mem_heap_hi_in - mem_heap_hi on a given heap
+ */
+void *mem_heap_hi_in(mem_t *mem)
+{
+    return (void *)(mem->mem_brk - 1);
+}
+
+/*
+ * mem_heapsize_in - mem_heapsize on a given heap
+ */
+size_t mem_heapsize_in(mem_t *mem)
+{
+    return (size_t)(mem->mem_brk - mem->mem_start_brk);
+}
@@ -1,11 +1,32 @@
 #include <unistd.h>
 
-void mem_init(void);               
+/*
+ * A mem_t models one independent heap: its own storage, brk pointer
+ * and upper bound. The mem_xxx functions below operate on a default
+ * instance set up by mem_init; the mem_xxx_in variants take an
+ * explicit instance created with mem_create.
+ */
+typedef struct mem_t {
+    char *mem_start_brk;  /* points to first byte of heap */
+    char *mem_brk;        /* points to last byte of heap */
+    char *mem_max_addr;   /* largest legal heap address */
+} mem_t;
+
+void mem_init(void);
 void mem_deinit(void);
 void *mem_sbrk(int incr);
-void mem_reset_brk(void); 
+void mem_reset_brk(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
 
+mem_t *mem_default(void);
+mem_t *mem_create(size_t max_heap);
+void mem_destroy(mem_t *mem);
+void *mem_sbrk_in(mem_t *mem, int incr);
+void mem_reset_brk_in(mem_t *mem);
+void mem_trim_in(mem_t *mem, size_t size);
+void *mem_heap_lo_in(mem_t *mem);
+void *mem_heap_hi_in(mem_t *mem);
+size_t mem_heapsize_in(mem_t *mem);
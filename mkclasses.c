@@ -0,0 +1,277 @@
+/*
+ * mkclasses.c - generate the size classes of mm.c from recorded traces
+ *
+ *     unix> mkclasses [-n <classes>] [-m <max size>] file.rep ... > sizeclasses.h
+ *
+ * Every request of the traces is rounded to the alignment and weighted
+ * by its live time, i.e. the number of ops between the request and the
+ * free (or realloc, or end of trace) that ends it. Among the requested
+ * sizes up to <max size>, we pick the <classes> sizes that minimize the
+ * weighted internal fragmentation of rounding each request up to the
+ * next class: a long-lived block pays its waste for a long time.
+ *
+ * The optimal choice is found by dynamic programming over the sorted
+ * distinct sizes: the last class is always the largest size, and the
+ * classes below split the sizes into consecutive runs.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <float.h>
+
+#include "trace.h"
+#include "config.h"
+
+#define DEFAULT_CLASSES 8        /* number of classes to generate */
+#define DEFAULT_MAX_SIZE 4096    /* larger requests are not classed */
+
+/* Rounds up to the alignment of the payloads, as mm.c does */
+#define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1))
+
+int verbose = 0; /* read by trace.c */
+
+/* Live-time weight of each aligned size, indexed by size/ALIGNMENT */
+static double *weights;
+static int max_size = DEFAULT_MAX_SIZE;
+
+/*
+ * add_request - account a request of size bytes living for ops ops
+ */
+static void add_request(int size, int ops)
+{
+    if (size <= 0 || size > max_size)
+	return;
+    weights[ALIGN(size) / ALIGNMENT] += ops;
+}
+
+/*
+ * add_trace - accumulate the weighted size histogram of one trace
+ */
+static void add_trace(trace_t *trace)
+{
+    int *born = malloc(trace->num_ids * sizeof(int));
+    int *size = malloc(trace->num_ids * sizeof(int));
+    int i, index;
+
+    if (born == NULL || size == NULL) {
+	fprintf(stderr, "mkclasses: out of memory\n");
+	exit(1);
+    }
+    memset(size, 0, trace->num_ids * sizeof(int));
+
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    born[index] = i;
+	    size[index] = trace->ops[i].size;
+	    break;
+	case REALLOC:
+	    /* the old block dies, a block of the new size is born */
+	    add_request(size[index], i - born[index]);
+	    born[index] = i;
+	    size[index] = trace->ops[i].size;
+	    break;
+	case FREE:
+	    add_request(size[index], i - born[index]);
+	    size[index] = 0;
+	    break;
+	case REGION_ALLOC:
+	case REGION_RESET:
+	    /* region blocks are bump-allocated, size classes don't apply */
+	    break;
+	}
+    }
+
+    /* blocks still alive at the end of the trace */
+    for (index = 0; index < trace->num_ids; index++)
+	if (size[index] > 0)
+	    add_request(size[index], trace->num_ops - born[index]);
+
+    free(born);
+    free(size);
+}
+
+/*
+ * choose_classes - pick at most k classes among the n sizes (sorted,
+ *     with weights w) minimizing the weighted waste. Returns the number
+ *     of classes written to classes, and the waste in *waste.
+ */
+static int choose_classes(int n, int *sizes, double *w, int k,
+			  int *classes, double *waste)
+{
+    double *sw = calloc(n + 1, sizeof(double));  /* prefix sums of w */
+    double *ssw = calloc(n + 1, sizeof(double)); /* ... and of w*size */
+    double *cost = malloc((k + 1) * (n + 1) * sizeof(double));
+    int *from = malloc((k + 1) * (n + 1) * sizeof(int));
+    int i, j, c, count;
+
+    if (sw == NULL || ssw == NULL || cost == NULL || from == NULL) {
+	fprintf(stderr, "mkclasses: out of memory\n");
+	exit(1);
+    }
+    if (k > n)
+	k = n;
+
+    for (i = 0; i < n; i++) {
+	sw[i + 1] = sw[i] + w[i];
+	ssw[i + 1] = ssw[i] + w[i] * sizes[i];
+    }
+
+    /*
+     * cost[c*(n+1) + i] is the least waste of the i smallest sizes with
+     * c classes, the largest being sizes[i-1]; from[] remembers where
+     * its run of sizes starts.
+     */
+    for (c = 0; c <= k; c++)
+	for (i = 0; i <= n; i++)
+	    cost[c * (n + 1) + i] = (i == 0) ? 0 : DBL_MAX;
+
+    for (c = 1; c <= k; c++) {
+	for (i = 1; i <= n; i++) {
+	    for (j = 1; j <= i; j++) {
+		double before = cost[(c - 1) * (n + 1) + j - 1];
+		double run;
+		if (before == DBL_MAX)
+		    continue;
+		/* sizes j-1 .. i-1 all rounded up to sizes[i-1] */
+		run = sizes[i - 1] * (sw[i] - sw[j - 1]) - (ssw[i] - ssw[j - 1]);
+		if (before + run < cost[c * (n + 1) + i]) {
+		    cost[c * (n + 1) + i] = before + run;
+		    from[c * (n + 1) + i] = j;
+		}
+	    }
+	}
+    }
+
+    /* walk back from the best solution with all the sizes */
+    *waste = cost[k * (n + 1) + n];
+    count = 0;
+    for (c = k, i = n; i > 0; c--) {
+	classes[count++] = sizes[i - 1];
+	i = from[c * (n + 1) + i] - 1;
+    }
+
+    /* classes were found from the largest down */
+    for (i = 0; i < count / 2; i++) {
+	int tmp = classes[i];
+	classes[i] = classes[count - 1 - i];
+	classes[count - 1 - i] = tmp;
+    }
+
+    free(sw);
+    free(ssw);
+    free(cost);
+    free(from);
+    return count;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mkclasses [-h] [-n <classes>] [-m <max size>] <file.rep>...\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h             Print this message.\n");
+    fprintf(stderr, "\t-m <max size>  Largest request size to class (default %d).\n",
+	    DEFAULT_MAX_SIZE);
+    fprintf(stderr, "\t-n <classes>   Number of classes (default %d).\n",
+	    DEFAULT_CLASSES);
+}
+
+int main(int argc, char **argv)
+{
+    int num_classes = DEFAULT_CLASSES;
+    int num_buckets, n, i, count;
+    int *sizes, *classes;
+    double *w;
+    double total = 0, waste, requested = 0;
+    char c;
+
+    while ((c = getopt(argc, argv, "hn:m:")) != EOF) {
+	switch (c) {
+	case 'n':
+	    num_classes = atoi(optarg);
+	    break;
+	case 'm':
+	    max_size = atoi(optarg);
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (optind == argc || num_classes < 1 || max_size < ALIGNMENT) {
+	usage();
+	exit(1);
+    }
+
+    num_buckets = ALIGN(max_size) / ALIGNMENT + 1;
+    weights = calloc(num_buckets, sizeof(double));
+    sizes = malloc(num_buckets * sizeof(int));
+    w = malloc(num_buckets * sizeof(double));
+    classes = malloc(num_buckets * sizeof(int));
+    if (weights == NULL || sizes == NULL || w == NULL || classes == NULL) {
+	fprintf(stderr, "mkclasses: out of memory\n");
+	exit(1);
+    }
+
+    for (i = optind; i < argc; i++) {
+	trace_t *trace = read_trace("", argv[i]);
+	add_trace(trace);
+	free_trace(trace);
+    }
+
+    /* the distinct sizes actually requested, in increasing order */
+    n = 0;
+    for (i = 1; i < num_buckets; i++) {
+	if (weights[i] > 0) {
+	    sizes[n] = i * ALIGNMENT;
+	    w[n] = weights[i];
+	    total += w[n];
+	    requested += w[n] * sizes[n];
+	    n++;
+	}
+    }
+    if (n == 0) {
+	fprintf(stderr, "mkclasses: no request of at most %d bytes\n", max_size);
+	exit(1);
+    }
+
+    count = choose_classes(n, sizes, w, num_classes, classes, &waste);
+
+    printf("/*\n");
+    printf(" * sizeclasses.h - size classes of mm.c, generated by mkclasses from\n");
+    printf(" *   ");
+    for (i = optind; i < argc; i++)
+	printf(" %s", argv[i]);
+    printf("\n");
+    printf(" * %d distinct sizes up to %d bytes, weighted by live time.\n", n, max_size);
+    printf(" * Weighted internal fragmentation of the classes: %.2f%%\n",
+	   100.0 * waste / (requested + waste));
+    printf(" *\n");
+    printf(" * Do not edit: regenerate with \"make classes\".\n");
+    printf(" */\n");
+    printf("#ifndef __SIZECLASSES_H_\n");
+    printf("#define __SIZECLASSES_H_\n\n");
+    printf("#include <stddef.h>\n\n");
+    printf("#define MM_NUM_SIZE_CLASSES %d\n\n", count);
+    printf("/* payload sizes in bytes, increasing */\n");
+    printf("static const size_t mm_size_classes[MM_NUM_SIZE_CLASSES] = {");
+    for (i = 0; i < count; i++)
+	printf("%s%d%s", (i % 8 == 0) ? "\n    " : " ", classes[i],
+	       (i + 1 < count) ? "," : "");
+    printf("\n};\n\n");
+    printf("#endif /* __SIZECLASSES_H_ */\n");
+
+    free(weights);
+    free(sizes);
+    free(w);
+    free(classes);
+    return 0;
+}
@@ -40,14 +40,29 @@
  * Once the free region found, the driver allocates just the right amount of blocks, 
  * 		/!\ except if the resulting free region left would be smaller than 4 words
  * 			in that case, the free region is entirely used
+ * Blocks up to MM_SMALL_REQUEST bytes are carved from the high end of the free region, larger
+ * ones from its low end (see MM_PLACEMENT) : small blocks gather at the top of the holes they
+ * fill, and leave the low end free in one piece for the next large request.
+ * 
+ * With MM_SIZE_CLASSES, requests up to the largest size class of sizeclasses.h are first
+ * rounded up to their class. The classes are generated from recorded traces by mkclasses, so
+ * that the few dominant sizes of those traces are served exactly. It is off by default: the 8
+ * shipped classes are sparse, and cost binary-bal (55% -> 37%) and realloc-bal (44% -> 37%)
+ * more than they give binary2-bal (51% -> 75%), and any other workload pays their rounding.
  * 
  * 	b - FREE
  * after setting metas to "free", the driver attempts to merge it with the neighbouring free regions
  * 
  * 	c - REALLOC
  * When requested for an extension, realloc first checks if the existing block is already fitting the request
+ * If it does, the tail of the block is given back (and merged with a free successor), unless it is
+ * smaller than the realloc slack (MM_REALLOC_SLACK, mm_set_realloc_slack) : a buffer shrunk from
+ * 1 MB to 1 KB releases the rest, while a size that oscillates by a few bytes keeps its block
  * If no, it checks if the block is followed by a large enough free zone
  * If no, it copies the data to another place (found by malloc()), then free the initial zone
+ * Payloads of at least MM_NT_THRESHOLD bytes are copied by a SSE2/AVX2 kernel, picked at the
+ * first move from what CPUID reports, that writes with non-temporal stores : a multi-MB move
+ * does not flush the working set out of the cache. Smaller ones go through memcpy.
  * 
  * 	d - EXPLICIT FREE LIST
  * 
@@ -55,127 +70,1401 @@
  * the idea is the following. As we made sure that each free block is at least 4 words long, including the metas, 
  * we can add more info: NEXT and PREV
  * 
- * 0		4		8		12		16		20		24		28		32		36		40
- * |NEXT	|m_st	|blk	|blk2	|m_end	|m_st	|NEXT	|free2	|free3	|PREV	|m_end
- * 					|///////////////|				|-------------------------------|
- * |5 	   	|		|occupied block	|				| 0     |			 	|5  	|
+ * 0		4		8		12		16		20		24		28		32		36		40
+ * |NEXT	|m_st	|blk	|blk2	|m_end	|m_st	|NEXT	|free2	|free3	|PREV	|m_end
+ * 					|///////////////|				|-------------------------------|
+ * |5 	   	|		|occupied block	|				| 0     |			 	|5  	|
+ * 
+ * NEXT is the number of word from m_st to the m_st of the next free block, and PREV to the previous free block.
+ * Notice that the very first block gives the offset to the first free block, and the previous of the first free block goes back to
+ * the very first block
+ * If a free block is last in line, his next is 0. 
+ * All offsets are relative to m_st, which is why PREV is 5 (5*4 = 20 -> m_st) in the example above
+ *
+ * ==================
+ * 3 - SIDE BITMAPS
+ * ==================
+ * Every m_st lies at beginning + 1 + 2k words : the heap is cut in 8-byte granules, and a block
+ * always starts at the beginning of one. Each heap keeps, out of the heap, two bitmaps with one
+ * bit per granule :
+ *  -	startBits : 1 if a block starts in this granule
+ *  -	allocBits : 1 if that block is occupied
+ * setMetas keeps them up to date. Heap walks, free space accounting and the search of the
+ * biggest free block (mm_stats, mm_check, findBigestFreeSpace) sweep these compact arrays a
+ * word at a time with popcount/ctz instead of chasing metas through the heap.
+ *
+ * =============
+ * 4 - REGIONS
+ * =============
+ * A region (mm_region_xxx) serves objects that die together. It takes chunks of at least
+ * chunkSize bytes from its heap with our_mm_malloc, and hands out their payload by moving
+ * a bump pointer : region objects have no metas, and are never freed one by one.
+ * The first 8 bytes of each chunk link it to the previous one, so that mm_region_reset
+ * gives every chunk back to the heap in one walk. Requests larger than a quarter of a chunk
+ * get a chunk of their own, leaving the current one open.
+ *
+ * ===========
+ * 5 - POOLS
+ * ===========
+ * A pool (mm_pool_xxx) serves objects of a single size. It takes slabs of objects from its
+ * heap with our_mm_memalign, and keeps the free objects in a singly linked list whose links
+ * are stored in the free objects themselves : get and put just pop and push the head of
+ * the list. Slabs are never split nor coalesced, they go back to the heap when the pool is
+ * destroyed. The link to the previous slab lies after the last object of each slab.
+ *
+ * ===================================
+ * 6 - HANDLES AND COMPACTION
+ * ===================================
+ * mm_halloc gives a handle instead of an address : an index in a table, kept out of the heap,
+ * that holds the start meta of the block. The first word after the meta holds the handle back,
+ * so that a block can be traced to its handle (the payload starts 2 words later, aligned).
+ * 
+ * 0		4		8		12		16		20
+ * |m_st	|handle	|pad	|payload........|m_end
+ * 
+ * mm_compact walks the heap from a cursor kept between calls, and slides every unpinned handle
+ * block over the free block in front of it, patching its entry in the table. Once the moved
+ * bytes reach its budget, it stops; once the free space gathered at the top exceeds a page,
+ * the heap is trimmed (mem_trim_in).
+ *
+ * ===================================
+ * 7 - HEAP PROFILE
+ * ===================================
+ * Once mm_profile_start(n) is called, mm_malloc, mm_memalign and mm_realloc sample about one
+ * allocation per n bytes : a countdown drawn from an exponential distribution of mean n is
+ * decreased by each request, and the request that crosses zero is sampled, so that a block is
+ * sampled with a probability that grows with its size. A sampled block has its call stack
+ * (backtrace) recorded in a bucket shared by all the samples of the same stack, and its pointer
+ * in a table of live samples that mm_free looks up. Both tables are mmapped out of the heaps.
+ * mm_profile_dump writes the buckets in the text format of pprof (heap_v2), which scales the
+ * samples back to estimated totals. When the profiler is off, the only cost is one test per call.
+ *
+ * ===================================
+ * 8 - THREADS AND REMOTE FREES
+ * ===================================
+ * Each thread works on its current heap (mm_heap_select), and a heap is never locked : only
+ * the thread that owns it may allocate or free in it directly. Another thread gives a block
+ * back with mm_heap_free_remote, which pushes the payload on the remoteFrees list of the heap
+ * with a compare-and-swap, the link to the next payload stored in the payload itself. The
+ * owner takes the whole list at once (atomic exchange) at its next allocation and frees the
+ * blocks then, so a remote free costs a CAS on the freeing side and a normal free later.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <execinfo.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include "mm.h"
+#include "memlib.h"
+#include "sizeclasses.h"
+#include <stdarg.h>
+
+team_t team = {
+    /* Team name */
+    "Dexter",
+    /* First member's full name */
+    "Amaury Camus",
+    /* First member's email address */
+    "amaury.camus@polytechnique.edu",
+    /* Second member's full name (leave blank if none) */
+    "Gregoire Roussel",
+    /* Second member's email address (leave blank if none) */
+	"gregoire.roussel@polytechnique.edu"};
+
+/* single word (4) or double word (8) alignment */
+#define ALIGNMENT 8
+
+/* rounds up to the nearest multiple of ALIGNMENT */
+#define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~0x7)
+
+#define DIFF_PTRS_IN_WORD(ptr1, ptr2) (int)(((long)ptr1 - (long)ptr2) / WORD_SIZE)
+
+#define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
+
+//set to 1 for more detailed runs
+#define VERBOSE 0
+//used in personal logging functions
+#define LOG_SIZE 1024
+
+#define TRY_EXPLICIT_LIST 0
+
+//set to 0 to silence the diagnostics printed on stderr when the heap goes wrong (libmm.so does)
+#ifndef MM_DIAGNOSTICS
+#define MM_DIAGNOSTICS 1
+#endif
+
+//set to 1 to prefetch the metas of the next candidate blocks while searching free space
+#ifndef MM_PREFETCH
+#define MM_PREFETCH 0
+#endif
+
+//set to 0 to always carve the allocated block from the low end of the free block found
+#ifndef MM_PLACEMENT
+#define MM_PLACEMENT 1
+#endif
+
+//set to 1 to round requests up to the classes of sizeclasses.h
+#ifndef MM_SIZE_CLASSES
+#define MM_SIZE_CLASSES 0
+#endif
+
+/**
+ * Internal logging
+ */
+void glog(const char *format, ...);
+void diag(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+/**
+ * Elementary bit/word reading/manipulation functions
+ */
+//META WORDS
+
+int getStatusBit(int *metaWord);
+void setStatusBit(int *metaWord, int status);
+size_t getSize(int *metaWord);
+void setSize(int *metaWord, size_t size);
+
+//REGIONS
+int *getStartMeta(void *blockPointer);
+int *getEndMeta(int *blockPointer);
+bool setMetas(int *meta, int size, int status);
+bool isPreviousFree(int *blockPointer, int *previousSize);
+
+//SIDE BITMAPS
+size_t granuleOf(int *meta);
+void bitmapSet(unsigned long *bits, size_t granule, int value);
+void bitmapClearRange(unsigned long *bits, size_t from, size_t to);
+void bitmapMarkBlock(int *meta, int size, int status);
+size_t bitmapNextStart(size_t from, size_t end);
+size_t bitmapNextFree(size_t from, size_t end);
+unsigned long *bitmapAlloc(size_t words);
+
+//EXPLORATION
+bool isNextFree(int *blockPointer, int *nextSize);
+int getNextFreeOffset(int *startMeta);
+int getPreviousFreeOffset(int *startMeta);
+void setNextFree(int *startMeta, int offset);
+void setPreviousFree(int *startMeta, int offset);
+
+//HEAP PROFILE
+void profileAlloc(void *ptr, size_t size);
+void profileFree(void *ptr);
+size_t profileNextSample();
+void profileForgetLive(mm_heap_t *h);
+
+//REMOTE FREES
+void drainRemoteFrees();
+
+/**
+ * Core functions
+ * our_mm_malloc, our_mm_free, our_mm_realloc do the "real" job, when called by their respective wrappers
+ */
+int *our_mm_malloc(size_t size);
+int *allocateInZone(size_t size, int zone);
+int *our_mm_realloc(int *ptr, size_t size, size_t alignment);
+int *our_mm_memalign(size_t alignment, size_t size);
+size_t roundToSizeClass(size_t size);
+void copyPayload(void *dst, const void *src, size_t bytes);
+void pickCopyKernel();
+char *newRegionChunk(mm_region_t *region, size_t bytes);
+bool growPool(mm_pool_t *pool);
+void our_mm_free(int *blockPtr);
+int init_heap();
+void update_heap_end();
+bool findFirstFreeSpace(size_t size, int **freeBlock);
+bool findLastFreeSpace(size_t size, int **freeBlock);
+bool mm_check();
+void findBigestFreeSpace(int *size, int **freeBlock);
+bool isMetaValid(int *meta);
+bool findBestFreeSpace(size_t size, int** freeBlock);
+bool putFreeBlockInFreeList(int* startMeta);
+bool takeFreeBlockOutOfTheList(int* startMeta);
+bool findFirstFreeSpaceInExplicitList(size_t size, int** freeBlock);
+
+
+/**
+ * size of the new page requested to mem_sbrk when memory looks full
+ */
+const size_t add_block_size = 1 << 12;
+
+const size_t WORD_SIZE = 4;
+
+/**
+ * bytes between the start meta of a handle block and its payload : the handle, and a pad word
+ */
+#define HANDLE_HEADER_SIZE 8
+
+/**
+ * with MM_PLACEMENT, blocks up to this size (metas included) are taken from the high end
+ * of the free block found, larger ones from the low end
+ */
+#ifndef MM_SMALL_REQUEST
+#define MM_SMALL_REQUEST 4096
+#endif
+const size_t small_request_size = MM_SMALL_REQUEST;
+
+#define BITS_PER_LONG (8 * sizeof(unsigned long))
+
+/**
+ * One entry of the handle table of a heap
+ */
+typedef struct
+{
+	int *meta;			// start meta of the block, NULL if the handle is free
+	int pins;			// mm_hpin calls not undone yet : the block may not move
+	mm_handle_t nextFree;	// next free handle, when this one is free
+} handleEntry;
+
+handleEntry *getHandleEntry(mm_handle_t handle);
+handleEntry *getMovableEntry(int *meta);
+
+/**
+ * State of one heap : the simulated memory it lives in (memlib) and the
+ * pointers the allocator navigates with.
+ * All the functions below work on the heap pointed by "heap", which is the
+ * default heap unless a mm_heap_xxx wrapper or mm_heap_select chose another one.
+ * Each thread has its own "heap" : threads working on distinct heaps run
+ * concurrently, a heap itself is never locked.
+ */
+struct mm_heap
+{
+	mem_t *mem;
+	int *beginning;
+	size_t heap_size;
+	int *current_heap;
+	int *heap_end;
+	unsigned long *startBits;
+	unsigned long *allocBits;
+	size_t bitmapWords;
+	handleEntry *handles;
+	size_t handleCapacity;
+	mm_handle_t handleCount;
+	mm_handle_t freeHandles;
+	size_t compactCursor;
+	void *remoteFrees;
+};
+
+/**
+ * bytes of a new heap, before any hint
+ */
+const size_t initial_heap_size = 1 << 8;
+
+/**
+ * largest heap mm_init_hint starts with (mem_sbrk takes an int)
+ */
+const size_t max_hinted_heap_size = 1 << 30;
+
+mm_heap_t defaultHeap = {NULL, NULL, 1 << 8, NULL, NULL, NULL, NULL, 0, NULL, 0, 0, 0, 0, NULL};
+__thread mm_heap_t *heap = &defaultHeap;
+
+/**
+ * State of one region : the heap its chunks come from, the list of chunks
+ * (most recent first) and the free part of the current one
+ */
+struct mm_region
+{
+	mm_heap_t *owner;
+	int *chunks;
+	char *bump;
+	char *limit;
+	size_t chunkSize;
+};
+
+/**
+ * default chunk size of the regions, in bytes
+ */
+const size_t region_chunk_size = 1 << 12;
+
+/**
+ * State of one pool : the heap its slabs come from, the list of slabs
+ * (most recent first) and the list of free objects
+ */
+struct mm_pool
+{
+	mm_heap_t *owner;
+	void *freeObjects;
+	int *slabs;
+	size_t objectSize;
+	size_t alignment;
+	size_t slabObjects;
+};
+
+/**
+ * a pool slab holds at least this many bytes of objects
+ */
+const size_t pool_slab_size = 1 << 12;
+
+/**
+ * bytes in front of a chunk payload, holding the link to the previous chunk
+ */
+#define CHUNK_HEADER_SIZE ALIGN(sizeof(int *))
+
+int totalAlloc = 0;
+int numberOfFree = 0;
+
+/**
+ * number of blocks examined by the free space finders of this thread since the start
+ */
+__thread unsigned long probeCount = 0;
+
+/**
+ * a shrinking realloc keeps the tail of the block if it is smaller than this (in bytes) :
+ * a block whose size oscillates a little is not split and merged back on every call
+ */
+#ifndef MM_REALLOC_SLACK
+#define MM_REALLOC_SLACK 1024
+#endif
+size_t reallocSlack = MM_REALLOC_SLACK;
+
+/**
+ * number of shrinking reallocs of this thread that gave the tail of their block back
+ */
+__thread unsigned long shrinkCount = 0;
+
+/**
+ * heap profile : one bucket per sampled call stack, and the live samples by pointer
+ */
+#define PROFILE_DEPTH 32
+#define PROFILE_BUCKETS (1 << 12)
+#define PROFILE_LIVE (1 << 16)
+
+typedef struct
+{
+	int depth;					// 0 if the bucket is unused
+	void *stack[PROFILE_DEPTH];
+	size_t allocObjects;		// samples taken since mm_profile_start
+	size_t allocBytes;
+	size_t inuseObjects;		// samples not freed yet
+	size_t inuseBytes;
+} profileBucket;
+
+typedef struct
+{
+	void *ptr;					// NULL if the slot is unused
+	size_t size;
+	profileBucket *bucket;
+} profileSample;
+
+size_t profileRate = 0;			// mean bytes between samples, 0 when the profiler is off
+size_t profileLiveCount = 0;
+size_t profileDropped = 0;		// samples lost to full tables
+unsigned profileGeneration = 0;	// mm_profile_start calls so far
+profileBucket *profileBuckets = NULL;
+profileSample *profileLive = NULL;
+// threads sampling at once share the tables above under this lock
+char profileLock = 0;
+
+/**
+ * each thread counts down its own bytes, from its own random stream
+ */
+__thread long profileCountdown = 0;		// bytes to allocate before the next sample
+__thread unsigned profileThreadGeneration = 0;	// profileGeneration the countdown was drawn for
+__thread int profileBusy = 0;			// set while a sample is taken : backtrace may allocate
+__thread uint64_t profileRandom = 0;	// 64-bit even on -m32 builds, seeded on first use
+
+/**
+ * a realloc that moves a payload of at least this size (in bytes) copies it with
+ * non-temporal stores, which bypass the cache : about the size of a L2 cache
+ */
+#ifndef MM_NT_THRESHOLD
+#define MM_NT_THRESHOLD (2 << 20)
+#endif
+size_t ntThreshold = MM_NT_THRESHOLD;
+
+/**
+ * copy kernel of large realloc moves, chosen on the first one
+ */
+typedef void (*copyKernel)(void *dst, const void *src, size_t bytes);
+copyKernel largeCopy = NULL;
+const char *largeCopyName = "memcpy";
+
+/**
+ * lays the first words of an empty heap in heap->mem
+ */
+int init_heap()
+{
+	if (heap->startBits == NULL)
+	{
+		// one bit per granule of the largest heap the mem can hold
+		size_t maxBytes = heap->mem->mem_max_addr - heap->mem->mem_start_brk;
+		heap->bitmapWords = maxBytes / (2 * WORD_SIZE) / BITS_PER_LONG + 1;
+		heap->startBits = bitmapAlloc(heap->bitmapWords);
+		heap->allocBits = bitmapAlloc(heap->bitmapWords);
+		if (heap->startBits == NULL || heap->allocBits == NULL)
+		{
+			return -1;
+		}
+	}
+	else if (heap->current_heap != NULL)
+	{
+		// only the part used by the previous heap may be dirty
+		size_t usedWords = granuleOf(heap->current_heap) / BITS_PER_LONG + 1;
+		memset(heap->startBits, 0, usedWords * sizeof(unsigned long));
+		memset(heap->allocBits, 0, usedWords * sizeof(unsigned long));
+	}
+
+	// the handles die with the blocks, the table stays mapped
+	heap->handleCount = 0;
+	heap->freeHandles = 0;
+	heap->compactCursor = 0;
+	heap->remoteFrees = NULL;
+
+	heap->beginning = (int *)mem_sbrk_in(heap->mem, heap->heap_size);
+	if (heap->beginning == (void *)-1)
+	{
+		return -1;
+	}
+	*heap->beginning = 0;
+	heap->current_heap = heap->beginning + 1;
+	update_heap_end();
+	return 0;
+}
+
+/*
+ * mm_init - initialize the malloc package.
+ */
+int mm_init(void)
+{
+	return mm_init_hint(0, 0);
+}
+
+/**
+ * Initializes the malloc package with a heap large enough for the expected
+ * payload bytes and number of live objects (their metas), so that the first
+ * requests don't grow the heap one sbrk at a time. 0, 0 gives the default.
+ */
+int mm_init_hint(size_t expected_bytes, size_t expected_live_objects)
+{
+	heap = &defaultHeap;
+	heap->mem = mem_default();
+
+	size_t hinted = ALIGN(expected_bytes) + expected_live_objects * 2 * WORD_SIZE;
+	size_t maxBytes = heap->mem->mem_max_addr - heap->mem->mem_start_brk;
+	if (hinted > maxBytes / 2)
+	{
+		// a hint is no reason to fail: leave room for the real requests
+		hinted = maxBytes / 2;
+	}
+	if (hinted > max_hinted_heap_size)
+	{
+		hinted = max_hinted_heap_size;
+	}
+	heap->heap_size = (hinted > initial_heap_size) ? ALIGN(hinted) : initial_heap_size;
+	profileForgetLive(heap);
+	return init_heap();
+}
+
+/**
+ * Drops every block of the current heap at once. The heap keeps its size, so the
+ * next requests reuse its pages without growing it; with keep_pages at 0, the
+ * whole pages of the heap are given back to the system (mem storage from mmap),
+ * to be faulted in again, zeroed, on reuse.
+ * Regions and pools of the heap die with their blocks, and so do the remote frees not
+ * taken yet : no other thread may free in the heap meanwhile.
+ */
+void mm_reset(int keep_pages)
+{
+	// only the part of the bitmaps used so far may be dirty
+	size_t usedWords = granuleOf(heap->current_heap) / BITS_PER_LONG + 1;
+	memset(heap->startBits, 0, usedWords * sizeof(unsigned long));
+	memset(heap->allocBits, 0, usedWords * sizeof(unsigned long));
+
+	if (!keep_pages)
+	{
+		uintptr_t pageSize = (uintptr_t)mem_pagesize();
+		uintptr_t first = ((uintptr_t)(heap->beginning + 1) + pageSize - 1) & ~(pageSize - 1);
+		uintptr_t last = (uintptr_t)heap->current_heap & ~(pageSize - 1);
+		if (last > first)
+		{
+			madvise((void *)first, last - first, MADV_DONTNEED);
+		}
+	}
+
+	// empty explicit list, and nothing allocated after the first word
+	*heap->beginning = 0;
+	heap->current_heap = heap->beginning + 1;
+	profileForgetLive(heap);
+	heap->handleCount = 0;
+	heap->freeHandles = 0;
+	heap->compactCursor = 0;
+	heap->remoteFrees = NULL;
+}
+
+/**
+ * mm_reset on a given heap
+ */
+void mm_heap_reset(mm_heap_t *h, int keep_pages)
+{
+	mm_heap_t *previous = heap;
+	heap = h;
+	mm_reset(keep_pages);
+	heap = previous;
+}
+
+/**
+ * Creates a heap independent from the default one, able to grow up to max_bytes
+ */
+mm_heap_t *mm_heap_create(size_t max_bytes)
+{
+	mm_heap_t *created = (mm_heap_t *)malloc(sizeof(mm_heap_t));
+	if (created == NULL)
+	{
+		return NULL;
+	}
+	created->mem = mem_create(max_bytes);
+	created->heap_size = initial_heap_size;
+	created->startBits = NULL;
+	created->allocBits = NULL;
+	created->handles = NULL;
+	created->handleCapacity = 0;
+	if (created->mem == NULL)
+	{
+		free(created);
+		return NULL;
+	}
+
+	mm_heap_t *previous = heap;
+	heap = created;
+	int result = init_heap();
+	heap = previous;
+
+	if (result < 0)
+	{
+		mm_heap_destroy(created);
+		return NULL;
+	}
+	return created;
+}
+
+/**
+ * Releases a heap and all the blocks it holds, in O(1) :
+ * blocks are never visited, the whole mem goes back at once
+ */
+void mm_heap_destroy(mm_heap_t *h)
+{
+	if (h == NULL || h == &defaultHeap)
+	{
+		return;
+	}
+	if (h->startBits != NULL)
+	{
+		munmap(h->startBits, h->bitmapWords * sizeof(unsigned long));
+	}
+	if (h->allocBits != NULL)
+	{
+		munmap(h->allocBits, h->bitmapWords * sizeof(unsigned long));
+	}
+	if (h->handles != NULL)
+	{
+		munmap(h->handles, h->handleCapacity * sizeof(handleEntry));
+	}
+	profileForgetLive(h);
+	mem_destroy(h->mem);
+	free(h);
+}
+
+/**
+ * Makes h (the default heap if NULL) the heap of the calling thread's mm_malloc,
+ * mm_free, mm_realloc, regions and pools, until the next call
+ * 
+ * @return the heap the thread used until now
+ */
+mm_heap_t *mm_heap_select(mm_heap_t *h)
+{
+	mm_heap_t *previous = heap;
+	heap = (h == NULL) ? &defaultHeap : h;
+	return previous;
+}
+
+/**
+ * Gives a block of heap h (the default heap if NULL) back from a thread that does not own h :
+ * the block is only queued, the owner frees it at its next allocation
+ */
+void mm_heap_free_remote(mm_heap_t *h, void *ptr)
+{
+	if (h == NULL)
+	{
+		h = &defaultHeap;
+	}
+	void *head = __atomic_load_n(&h->remoteFrees, __ATOMIC_RELAXED);
+	do
+	{
+		*(void **)ptr = head;
+	} while (!__atomic_compare_exchange_n(&h->remoteFrees, &head, ptr, true,
+										   __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/**
+ * frees the blocks other threads gave back to the current heap since the last call
+ */
+void drainRemoteFrees()
+{
+	void *ptr = __atomic_exchange_n(&heap->remoteFrees, NULL, __ATOMIC_ACQUIRE);
+	while (ptr != NULL)
+	{
+		void *next = *(void **)ptr;
+		mm_free(ptr);
+		ptr = next;
+	}
+}
+
+/**
+ * mm_malloc on a given heap
+ */
+void *mm_heap_malloc(mm_heap_t *h, size_t size)
+{
+	mm_heap_t *previous = heap;
+	heap = h;
+	void *allocatedPtr = mm_malloc(size);
+	heap = previous;
+	return allocatedPtr;
+}
+
+/**
+ * mm_free on a given heap
+ */
+void mm_heap_free(mm_heap_t *h, void *ptr)
+{
+	mm_heap_t *previous = heap;
+	heap = h;
+	mm_free(ptr);
+	heap = previous;
+}
+
+/**
+ * mm_realloc on a given heap
+ */
+void *mm_heap_realloc(mm_heap_t *h, void *ptr, size_t size)
+{
+	mm_heap_t *previous = heap;
+	heap = h;
+	void *reallocatedPtr = mm_realloc(ptr, size);
+	heap = previous;
+	return reallocatedPtr;
+}
+
+/**
+ * Creates a region on the current heap, taking chunks of chunk_bytes
+ * (region_chunk_size if 0). The record itself lives in the heap.
+ */
+mm_region_t *mm_region_create(size_t chunk_bytes)
+{
+	mm_region_t *region = (mm_region_t *)our_mm_malloc(sizeof(mm_region_t));
+	if (region == NULL)
+	{
+		return NULL;
+	}
+	region->owner = heap;
+	region->chunks = NULL;
+	region->bump = NULL;
+	region->limit = NULL;
+	region->chunkSize = (chunk_bytes == 0) ? region_chunk_size : ALIGN(chunk_bytes);
+	return region;
+}
+
+/**
+ * Takes a new chunk of bytes payload from the owner heap and links it to the region
+ * 
+ * @return pointer to the first usable byte of the chunk, NULL if the heap is full
+ */
+char *newRegionChunk(mm_region_t *region, size_t bytes)
+{
+	mm_heap_t *previous = heap;
+	heap = region->owner;
+	int *chunk = our_mm_malloc(CHUNK_HEADER_SIZE + bytes);
+	heap = previous;
+	if (chunk == NULL)
+	{
+		return NULL;
+	}
+	*(int **)chunk = region->chunks;
+	region->chunks = chunk;
+	return (char *)chunk + CHUNK_HEADER_SIZE;
+}
+
+/**
+ * Allocates size bytes in a region, by moving its bump pointer
+ * 
+ * @return pointer to the block, 8-byte aligned, NULL if the heap is full
+ */
+void *mm_region_alloc(mm_region_t *region, size_t size)
+{
+	char *block;
+
+	size = ALIGN(size);
+	if (size > region->chunkSize / 4)
+	{
+		//big requests would waste most of the current chunk
+		return newRegionChunk(region, size);
+	}
+	if (region->bump == NULL || size > (size_t)(region->limit - region->bump))
+	{
+		if ((block = newRegionChunk(region, region->chunkSize)) == NULL)
+		{
+			return NULL;
+		}
+		region->bump = block;
+		region->limit = block + region->chunkSize;
+	}
+	block = region->bump;
+	region->bump += size;
+	return block;
+}
+
+/**
+ * Releases every object of a region at once, by giving all its chunks back
+ * to the heap. The region can be used again.
+ */
+void mm_region_reset(mm_region_t *region)
+{
+	mm_heap_t *previous = heap;
+	heap = region->owner;
+	int *chunk = region->chunks;
+	while (chunk != NULL)
+	{
+		int *previousChunk = *(int **)chunk;
+		our_mm_free(chunk);
+		chunk = previousChunk;
+	}
+	heap = previous;
+	region->chunks = NULL;
+	region->bump = NULL;
+	region->limit = NULL;
+}
+
+/**
+ * Releases every object of a region and the region itself
+ */
+void mm_region_destroy(mm_region_t *region)
+{
+	if (region == NULL)
+	{
+		return;
+	}
+	mm_region_reset(region);
+	mm_heap_t *previous = heap;
+	heap = region->owner;
+	our_mm_free((int *)region);
+	heap = previous;
+}
+
+/**
+ * Creates a pool of objects of object_size bytes, aligned on alignment bytes
+ * (a power of two, 0 for the default 8), on the current heap
+ */
+mm_pool_t *mm_pool_create(size_t object_size, size_t alignment)
+{
+	if (alignment < ALIGNMENT)
+	{
+		alignment = ALIGNMENT;
+	}
+	if (object_size < sizeof(void *))
+	{
+		//a free object must hold the link to the next one
+		object_size = sizeof(void *);
+	}
+
+	mm_pool_t *pool = (mm_pool_t *)our_mm_malloc(sizeof(mm_pool_t));
+	if (pool == NULL)
+	{
+		return NULL;
+	}
+	pool->owner = heap;
+	pool->freeObjects = NULL;
+	pool->slabs = NULL;
+	pool->objectSize = (object_size + alignment - 1) & ~(alignment - 1);
+	pool->alignment = alignment;
+	pool->slabObjects = pool_slab_size / pool->objectSize;
+	if (pool->slabObjects < 8)
+	{
+		pool->slabObjects = 8;
+	}
+	return pool;
+}
+
+/**
+ * Takes a new slab from the owner heap and puts all its objects in the free list
+ * 
+ * @return false if the heap is full
+ */
+bool growPool(mm_pool_t *pool)
+{
+	size_t objectsBytes = pool->slabObjects * pool->objectSize;
+
+	mm_heap_t *previous = heap;
+	heap = pool->owner;
+	char *slab = (char *)our_mm_memalign(pool->alignment, objectsBytes + sizeof(int *));
+	heap = previous;
+	if (slab == NULL)
+	{
+		return false;
+	}
+	*(int **)(slab + objectsBytes) = pool->slabs;
+	pool->slabs = (int *)slab;
+
+	//link the objects from the last one, so that the list follows the addresses
+	for (size_t i = pool->slabObjects; i > 0; i--)
+	{
+		void *object = slab + (i - 1) * pool->objectSize;
+		*(void **)object = pool->freeObjects;
+		pool->freeObjects = object;
+	}
+	return true;
+}
+
+/**
+ * Takes an object from a pool
+ * 
+ * @return pointer to the object, NULL if the heap is full
+ */
+void *mm_pool_get(mm_pool_t *pool)
+{
+	if (pool->freeObjects == NULL && !growPool(pool))
+	{
+		return NULL;
+	}
+	void *object = pool->freeObjects;
+	pool->freeObjects = *(void **)object;
+	return object;
+}
+
+/**
+ * Gives an object back to the pool it was taken from
+ */
+void mm_pool_put(mm_pool_t *pool, void *object)
+{
+	*(void **)object = pool->freeObjects;
+	pool->freeObjects = object;
+}
+
+/**
+ * Releases a pool, its slabs and every object taken from it
+ */
+void mm_pool_destroy(mm_pool_t *pool)
+{
+	if (pool == NULL)
+	{
+		return;
+	}
+	size_t objectsBytes = pool->slabObjects * pool->objectSize;
+
+	mm_heap_t *previous = heap;
+	heap = pool->owner;
+	int *slab = pool->slabs;
+	while (slab != NULL)
+	{
+		int *previousSlab = *(int **)((char *)slab + objectsBytes);
+		our_mm_free(slab);
+		slab = previousSlab;
+	}
+	our_mm_free((int *)pool);
+	heap = previous;
+}
+
+/**
+ * Entry of a handle of the current heap, or NULL if it is not a live handle
+ */
+handleEntry *getHandleEntry(mm_handle_t handle)
+{
+	if (handle == 0 || handle > heap->handleCount || heap->handles[handle - 1].meta == NULL)
+	{
+		return NULL;
+	}
+	return &heap->handles[handle - 1];
+}
+
+/**
+ * Allocates a movable block of size bytes
+ * 
+ * @return its handle, 0 if the heap is full
+ */
+mm_handle_t mm_halloc(size_t size)
+{
+	if (heap->handles == NULL)
+	{
+		// one handle per smallest block (4 words, header included) of the largest heap the mem can hold
+		size_t maxBytes = heap->mem->mem_max_addr - heap->mem->mem_start_brk;
+		heap->handleCapacity = maxBytes / (4 * WORD_SIZE);
+		void *table = mmap(NULL, heap->handleCapacity * sizeof(handleEntry), PROT_READ | PROT_WRITE,
+						   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (table == MAP_FAILED)
+		{
+			return 0;
+		}
+		heap->handles = (handleEntry *)table;
+	}
+	if (heap->freeHandles == 0 && heap->handleCount == heap->handleCapacity)
+	{
+		return 0;
+	}
+
+	int *block = our_mm_malloc(size + HANDLE_HEADER_SIZE);
+	if (block == NULL)
+	{
+		return 0;
+	}
+
+	mm_handle_t handle = heap->freeHandles;
+	if (handle != 0)
+	{
+		heap->freeHandles = heap->handles[handle - 1].nextFree;
+	}
+	else
+	{
+		handle = ++heap->handleCount;
+	}
+	heap->handles[handle - 1].meta = block - 1;
+	heap->handles[handle - 1].pins = 0;
+	*block = (int)handle;
+	return handle;
+}
+
+/**
+ * Frees a movable block, and its handle
+ */
+void mm_hfree(mm_handle_t handle)
+{
+	handleEntry *entry = getHandleEntry(handle);
+	if (entry == NULL)
+	{
+		return;
+	}
+	our_mm_free(entry->meta + 1);
+	entry->meta = NULL;
+	entry->nextFree = heap->freeHandles;
+	heap->freeHandles = handle;
+}
+
+/**
+ * Resizes a movable block, which keeps its handle
+ * 
+ * @return 0, or -1 if the block is pinned (it could move) or the heap is full
+ */
+int mm_hrealloc(mm_handle_t handle, size_t size)
+{
+	handleEntry *entry = getHandleEntry(handle);
+	if (entry == NULL || entry->pins > 0)
+	{
+		return -1;
+	}
+	int *block = our_mm_realloc(entry->meta + 1, size + HANDLE_HEADER_SIZE, ALIGNMENT);
+	if (block == NULL)
+	{
+		return -1;
+	}
+	entry->meta = block - 1;
+	return 0;
+}
+
+/**
+ * Pins a movable block : it keeps its address until the matching mm_hunpin
  * 
- * NEXT is the number of word from m_st to the m_st of the next free block, and PREV to the previous free block.
- * Notice that the very first block gives the offset to the first free block, and the previous of the first free block goes back to
- * the very first block
- * If a free block is last in line, his next is 0. 
- * All offsets are relative to m_st, which is why PREV is 5 (5*4 = 20 -> m_st) in the example above
+ * @return address of the payload
  */
+void *mm_hpin(mm_handle_t handle)
+{
+	handleEntry *entry = getHandleEntry(handle);
+	if (entry == NULL)
+	{
+		return NULL;
+	}
+	entry->pins++;
+	return (char *)(entry->meta + 1) + HANDLE_HEADER_SIZE;
+}
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <assert.h>
-#include <unistd.h>
-#include <string.h>
-#include <stdbool.h>
-#include "mm.h"
-#include "memlib.h"
-#include <stdarg.h>
+/**
+ * Undoes a mm_hpin : the block may move again once all its pins are undone
+ */
+void mm_hunpin(mm_handle_t handle)
+{
+	handleEntry *entry = getHandleEntry(handle);
+	if (entry != NULL && entry->pins > 0)
+	{
+		entry->pins--;
+	}
+}
 
-team_t team = {
-    /* Team name */
-    "Dexter",
-    /* First member's full name */
-    "Amaury Camus",
-    /* First member's email address */
-    "amaury.camus@polytechnique.edu",
-    /* Second member's full name (leave blank if none) */
-    "Gregoire Roussel",
-    /* Second member's email address (leave blank if none) */
-	"gregoire.roussel@polytechnique.edu"};
+/**
+ * Handle entry of the block at meta, if it is an unpinned handle block
+ */
+handleEntry *getMovableEntry(int *meta)
+{
+	if (getStatusBit(meta) == 0)
+	{
+		return NULL;
+	}
+	//the word after the meta of a handle block points back to its entry
+	handleEntry *entry = getHandleEntry((mm_handle_t)meta[1]);
+	if (entry == NULL || entry->meta != meta || entry->pins > 0)
+	{
+		return NULL;
+	}
+	return entry;
+}
 
-/* single word (4) or double word (8) alignment */
-#define ALIGNMENT 8
+/**
+ * Slides unpinned handle blocks toward the beginning of the heap, until
+ * budget_bytes have been moved or the whole heap is compacted, then trims
+ * the free top of the heap. Calls resume where the previous one stopped.
+ * 
+ * @return number of bytes moved
+ */
+size_t mm_compact(size_t budget_bytes)
+{
+	size_t moved = 0;
 
-/* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~0x7)
+	if (heap->handleCount == 0)
+	{
+		return 0;
+	}
 
-#define DIFF_PTRS_IN_WORD(ptr1, ptr2) (int)(((long)ptr1 - (long)ptr2) / WORD_SIZE)
+	size_t end = granuleOf(heap->current_heap);
+	size_t granule = heap->compactCursor;
+	while (moved < budget_bytes)
+	{
+		granule = bitmapNextFree(granule, end);
+		if (granule >= end)
+		{
+			// the whole heap has been walked, start over next time
+			granule = 0;
+			break;
+		}
+		int *freeMeta = heap->beginning + 1 + 2 * granule;
+		int freeSize = getSize(freeMeta);
+		int *blockMeta = freeMeta + freeSize;
+		if (blockMeta >= heap->current_heap)
+		{
+			granule = end;
+			continue;
+		}
 
-#define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
+		handleEntry *entry = getMovableEntry(blockMeta);
+		if (entry == NULL)
+		{
+			// pinned or plain block : it stays, the free block before it too
+			granule = granuleOf(blockMeta) + getSize(blockMeta) / 2;
+			continue;
+		}
 
-//set to 1 for more detailed runs
-#define VERBOSE 0
-//used in personal logging functions
-#define LOG_SIZE 1024
+		// the block takes the place of the free block, which goes after it
+		int blockSize = getSize(blockMeta);
+		memmove(freeMeta, blockMeta, blockSize * WORD_SIZE);
+		setMetas(freeMeta, blockSize, 1);
+		setMetas(freeMeta + blockSize, freeSize, 1);
+		entry->meta = freeMeta;
+		our_mm_free(freeMeta + blockSize + 1);
+
+		moved += blockSize * WORD_SIZE;
+		end = granuleOf(heap->current_heap);
+		granule = granuleOf(freeMeta + blockSize);
+	}
+	heap->compactCursor = granule;
 
-#define TRY_EXPLICIT_LIST 0
+	// give back the top of the heap freed by the slides
+	size_t used = (size_t)(heap->current_heap - heap->beginning) * WORD_SIZE;
+	if (heap->heap_size - used > add_block_size)
+	{
+		mem_trim_in(heap->mem, used);
+		heap->heap_size = mem_heapsize_in(heap->mem);
+		update_heap_end();
+	}
+	return moved;
+}
 
 /**
- * Internal logging
+ * the profile tables are only touched under profileLock : the critical sections are short,
+ * so a spin lock does, and mm.c needs no thread library
  */
-void glog(const char *format, ...);
+static inline void profileLockTake()
+{
+	while (__atomic_test_and_set(&profileLock, __ATOMIC_ACQUIRE))
+	{
+		while (__atomic_load_n(&profileLock, __ATOMIC_RELAXED))
+		{
+		}
+	}
+}
 
-/**
- * Elementary bit/word reading/manipulation functions
+static inline void profileLockRelease()
+{
+	__atomic_clear(&profileLock, __ATOMIC_RELEASE);
+}
+
+/*
+ * mm_profile_start - samples about one allocation per sample_bytes from now on,
+ * forgetting the previous samples; 0 stops the profiler
  */
-//META WORDS
+int mm_profile_start(size_t sample_bytes)
+{
+	if (sample_bytes != 0 && profileBuckets == NULL)
+	{
+		void *buckets = mmap(NULL, PROFILE_BUCKETS * sizeof(profileBucket), PROT_READ | PROT_WRITE,
+							 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		void *live = mmap(NULL, PROFILE_LIVE * sizeof(profileSample), PROT_READ | PROT_WRITE,
+						  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (buckets == MAP_FAILED || live == MAP_FAILED)
+		{
+			return -1;
+		}
+		profileBuckets = (profileBucket *)buckets;
+		profileLive = (profileSample *)live;
 
-int getStatusBit(int *metaWord);
-void setStatusBit(int *metaWord, int status);
-size_t getSize(int *metaWord);
-void setSize(int *metaWord, size_t size);
+		// backtrace loads the unwinder on its first call, and may allocate then : not from a sample
+		void *stack[1];
+		backtrace(stack, 1);
+	}
+	profileLockTake();
+	if (profileBuckets != NULL)
+	{
+		memset(profileBuckets, 0, PROFILE_BUCKETS * sizeof(profileBucket));
+		memset(profileLive, 0, PROFILE_LIVE * sizeof(profileSample));
+	}
+	profileLiveCount = 0;
+	profileDropped = 0;
+	profileRate = sample_bytes;
+	// every thread draws a new countdown on its next request
+	profileGeneration++;
+	profileLockRelease();
+	return 0;
+}
 
-//REGIONS
-int *getStartMeta(void *blockPointer);
-int *getEndMeta(int *blockPointer);
-bool setMetas(int *meta, int size, int status);
-bool isPreviousFree(int *blockPointer, int *previousSize);
+/*
+ * mm_profile_dump - writes the samples as a pprof heap profile (heap_v2 text format),
+ * followed by the mappings of the process that pprof needs to symbolize the stacks
+ */
+int mm_profile_dump(FILE *out)
+{
+	size_t inuseObjects = 0, inuseBytes = 0, allocObjects = 0, allocBytes = 0;
+	if (profileBuckets == NULL)
+	{
+		return -1;
+	}
 
-//EXPLORATION
-bool isNextFree(int *blockPointer, int *nextSize);
-int getNextFreeOffset(int *startMeta);
-int getPreviousFreeOffset(int *startMeta);
-void setNextFree(int *startMeta, int offset);
-void setPreviousFree(int *startMeta, int offset);
+	profileLockTake();
+	for (int b = 0; b < PROFILE_BUCKETS; b++)
+	{
+		inuseObjects += profileBuckets[b].inuseObjects;
+		inuseBytes += profileBuckets[b].inuseBytes;
+		allocObjects += profileBuckets[b].allocObjects;
+		allocBytes += profileBuckets[b].allocBytes;
+	}
+	size_t rate = profileRate;
+	profileLockRelease();
+
+	// printing may allocate and free : each bucket is copied out of the lock first
+	fprintf(out, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+			inuseObjects, inuseBytes, allocObjects, allocBytes, rate);
+	for (int b = 0; b < PROFILE_BUCKETS; b++)
+	{
+		profileBucket bucket;
+		profileLockTake();
+		bucket = profileBuckets[b];
+		profileLockRelease();
+		if (bucket.depth == 0)
+		{
+			continue;
+		}
+		fprintf(out, "%zu: %zu [%zu: %zu] @", bucket.inuseObjects, bucket.inuseBytes,
+				bucket.allocObjects, bucket.allocBytes);
+		for (int i = 0; i < bucket.depth; i++)
+		{
+			fprintf(out, " %p", bucket.stack[i]);
+		}
+		fprintf(out, "\n");
+	}
+
+	fprintf(out, "\nMAPPED_LIBRARIES:\n");
+	FILE *maps = fopen("/proc/self/maps", "r");
+	if (maps != NULL)
+	{
+		char line[512];
+		while (fgets(line, sizeof(line), maps) != NULL)
+		{
+			fputs(line, out);
+		}
+		fclose(maps);
+	}
+	return ferror(out) ? -1 : 0;
+}
 
 /**
- * Core functions
- * our_mm_malloc, our_mm_free, our_mm_realloc do the "real" job, when called by their respective wrappers
+ * bytes to allocate before the next sample : exponential of mean profileRate, so that
+ * the samples of a steady stream of requests form a Poisson process over the bytes
  */
-int *our_mm_malloc(size_t size);
-int *our_mm_realloc(int *ptr, size_t size);
-void our_mm_free(int *blockPtr);
-void update_heap_end();
-bool findFirstFreeSpace(size_t size, int **freeBlock);
-bool mm_check();
-void findBigestFreeSpace(int *size, int **freeBlock);
-bool isMetaValid(int *meta);
-bool findBestFreeSpace(size_t size, int** freeBlock);
-bool putFreeBlockInFreeList(int* startMeta);
-bool takeFreeBlockOutOfTheList(int* startMeta);
-bool findFirstFreeSpaceInExplicitList(size_t size, int** freeBlock);
+size_t profileNextSample()
+{
+	if (profileRandom == 0)
+	{
+		// a distinct stream per thread, never the all-zero state of xorshift
+		profileRandom = (UINT64_C(88172645463325252) ^ (uintptr_t)&profileRandom) | 1;
+	}
+	// xorshift64*, top 26 bits as a uniform in (0, 1]
+	profileRandom ^= profileRandom >> 12;
+	profileRandom ^= profileRandom << 25;
+	profileRandom ^= profileRandom >> 27;
+	double u = (double)(((profileRandom * UINT64_C(2685821657736338717)) >> 38) + 1) / (double)(1UL << 26);
+
+	// -ln(u) from the exponent and a quadratic fit of log2 on the mantissa, no libm needed
+	int exponent = 0;
+	while (u < 1.0)
+	{
+		u *= 2.0;
+		exponent--;
+	}
+	double m = u - 1.0;
+	double log2u = exponent + m * (1.3465 - 0.3465 * m);
+	return (size_t)(-log2u * 0.6931471805599453 * profileRate) + 1;
+}
+
+/**
+ * accounts a request of the profiled calls, and samples it if the countdown runs out
+ */
+void profileAlloc(void *ptr, size_t size)
+{
+	if (profileThreadGeneration != profileGeneration)
+	{
+		// first request of this thread since mm_profile_start
+		profileThreadGeneration = profileGeneration;
+		profileCountdown = (long)profileNextSample();
+	}
+	profileCountdown -= (long)size;
+	if (profileCountdown > 0 || ptr == NULL || profileBusy)
+	{
+		return;
+	}
+	profileBusy = 1;
+	profileCountdown = (long)profileNextSample();
+
+	void *stack[PROFILE_DEPTH + 1];
+	int depth = backtrace(stack, PROFILE_DEPTH + 1) - 1;
+	// stack[0] is profileAlloc itself
+	void **frames = stack + 1;
+
+	uintptr_t hash = (uintptr_t)depth;
+	for (int i = 0; i < depth; i++)
+	{
+		hash = hash * 31 + (uintptr_t)frames[i];
+	}
+	profileLockTake();
+	profileBucket *bucket = NULL;
+	for (size_t probe = 0; probe < PROFILE_BUCKETS; probe++)
+	{
+		profileBucket *candidate = &profileBuckets[(hash + probe) % PROFILE_BUCKETS];
+		if (candidate->depth == 0)
+		{
+			candidate->depth = depth;
+			memcpy(candidate->stack, frames, depth * sizeof(void *));
+			bucket = candidate;
+			break;
+		}
+		if (candidate->depth == depth && memcmp(candidate->stack, frames, depth * sizeof(void *)) == 0)
+		{
+			bucket = candidate;
+			break;
+		}
+	}
 
+	// a live table at most half full keeps the probes short
+	if (bucket == NULL || profileLiveCount >= PROFILE_LIVE / 2)
+	{
+		profileDropped++;
+		profileLockRelease();
+		profileBusy = 0;
+		return;
+	}
+	bucket->allocObjects++;
+	bucket->allocBytes += size;
+	bucket->inuseObjects++;
+	bucket->inuseBytes += size;
+
+	size_t slot = ((uintptr_t)ptr >> 3) % PROFILE_LIVE;
+	while (profileLive[slot].ptr != NULL)
+	{
+		slot = (slot + 1) % PROFILE_LIVE;
+	}
+	profileLive[slot].ptr = ptr;
+	profileLive[slot].size = size;
+	profileLive[slot].bucket = bucket;
+	profileLiveCount++;
+	profileLockRelease();
+	profileBusy = 0;
+}
 
 /**
- * size of the new page requested to mem_sbrk when memory looks full
+ * removes the sample of a slot, profileLock held : its bucket no longer counts it in use
  */
-const size_t add_block_size = 1 << 12;
+void profileRemoveSlot(size_t slot)
+{
+	profileLive[slot].bucket->inuseObjects--;
+	profileLive[slot].bucket->inuseBytes -= profileLive[slot].size;
+	profileLiveCount--;
 
-const size_t WORD_SIZE = 4;
-int *beginning;
-size_t heap_size = 1 << 8;
-int *current_heap;
-int *heap_end;
+	// backward shift : the samples after the hole move up if their home slot allows it
+	size_t hole = slot;
+	for (size_t next = (hole + 1) % PROFILE_LIVE; profileLive[next].ptr != NULL; next = (next + 1) % PROFILE_LIVE)
+	{
+		size_t home = ((uintptr_t)profileLive[next].ptr >> 3) % PROFILE_LIVE;
+		// next may fill the hole if its home is not in (hole, next]
+		if ((next > hole && (home <= hole || home > next)) || (next < hole && home <= hole && home > next))
+		{
+			profileLive[hole] = profileLive[next];
+			hole = next;
+		}
+	}
+	profileLive[hole].ptr = NULL;
+}
 
-int totalAlloc = 0;
-int numberOfFree = 0;
+/**
+ * forgets the sample of a block about to be freed, if it is one
+ */
+void profileFree(void *ptr)
+{
+	size_t slot = ((uintptr_t)ptr >> 3) % PROFILE_LIVE;
+	profileLockTake();
+	while (profileLive[slot].ptr != ptr)
+	{
+		if (profileLive[slot].ptr == NULL)
+		{
+			profileLockRelease();
+			return;
+		}
+		slot = (slot + 1) % PROFILE_LIVE;
+	}
+	profileRemoveSlot(slot);
+	profileLockRelease();
+}
 
-/* 
- * mm_init - initialize the malloc package.
+/**
+ * the blocks of heap h are all gone : so are their samples, not their history
+ * the samples of the other heaps, which other threads may be using, stay
  */
-int mm_init(void)
+void profileForgetLive(mm_heap_t *h)
 {
-	beginning = (int *)mem_sbrk(heap_size);
-	*beginning = 0;
-	current_heap = beginning + 1;
-	update_heap_end();
-    return 0;
+	if (profileLiveCount == 0)
+	{
+		return;
+	}
+	char *low = h->mem->mem_start_brk;
+	char *high = h->mem->mem_max_addr;
+	profileLockTake();
+	for (size_t slot = 0; slot < PROFILE_LIVE; slot++)
+	{
+		// a removal may shift another sample into this slot : look at it again
+		while (profileLive[slot].ptr != NULL && (char *)profileLive[slot].ptr >= low &&
+			   (char *)profileLive[slot].ptr < high)
+		{
+			profileRemoveSlot(slot);
+		}
+	}
+	profileLockRelease();
 }
 
 /**
@@ -184,7 +1473,7 @@ int mm_init(void)
  */
 void update_heap_end()
 {
-	heap_end = (int *)((void *)mem_heap_hi() - 3);
+	heap->heap_end = (int *)((void *)mem_heap_hi_in(heap->mem) - 3);
 }
 
 /* 
@@ -194,6 +1483,23 @@ void *mm_malloc(size_t size)
 {
 	void *allocatedPtr = (void *)our_mm_malloc(size);
 	//glog("Allocated %d bytes at %p", size, allocatedPtr);
+	if (profileRate != 0)
+	{
+		profileAlloc(allocatedPtr, size);
+	}
+	return allocatedPtr;
+}
+
+/*
+ * mm_malloc_hint - mm_malloc, told how long the block will live
+ */
+void *mm_malloc_hint(size_t size, int lifetime)
+{
+	void *allocatedPtr = (void *)allocateInZone(size, lifetime);
+	if (profileRate != 0)
+	{
+		profileAlloc(allocatedPtr, size);
+	}
 	return allocatedPtr;
 }
 
@@ -205,8 +1511,27 @@ void *mm_malloc(size_t size)
  */
 int *our_mm_malloc(size_t size)
 {
+	return allocateInZone(size, 0);
+}
+
+/**
+ * Allocates a block in the zone of its lifetime
+ * 
+ * @param size:size_t requested size in bytes
+ * @param zone:int MM_SHORT_LIVED, MM_LONG_LIVED, or 0 for no hint
+ * @return pointer to first usable word
+ */
+int *allocateInZone(size_t size, int zone)
+{
+	if (__atomic_load_n(&heap->remoteFrees, __ATOMIC_RELAXED) != NULL)
+	{
+		drainRemoteFrees();
+	}
 
 	//mm_check();
+#if MM_SIZE_CLASSES
+	size = roundToSizeClass(size);
+#endif
 	size_t newsize = (ALIGN(size) / WORD_SIZE + 2);
 	size_t newsizeInBytes = newsize * WORD_SIZE;
 	int *block;
@@ -214,7 +1539,7 @@ int *our_mm_malloc(size_t size)
 	
 	if (newsize < 4)
 	{
-		printf("Allocsize is small \n");
+		diag("Allocsize is small \n");
 	}
 	//printf("%p and %p", block, (void*)block);
 
@@ -227,6 +1552,10 @@ int *our_mm_malloc(size_t size)
 	{
 		isThereAFreeBlock = findFirstFreeSpaceInExplicitList(newsize, &possibleFreeBlock);
 	}
+	else if (zone == MM_SHORT_LIVED)
+	{
+		isThereAFreeBlock = findLastFreeSpace(newsize, &possibleFreeBlock);
+	}
 	else
 	{
 		isThereAFreeBlock = findFirstFreeSpace(newsize, &possibleFreeBlock);
@@ -245,6 +1574,14 @@ int *our_mm_malloc(size_t size)
 		{
 			setMetas(possibleFreeBlock, getSize(possibleFreeBlock), 1);
 		}
+		else if (zone == MM_SHORT_LIVED || (zone == 0 && MM_PLACEMENT && newsizeInBytes <= small_request_size))
+		{
+			// small and short-lived requests are carved from the high end of the free block
+			setMetas(possibleFreeBlock + leftOverSize, newsize, 1);
+			setMetas(possibleFreeBlock, leftOverSize, 0);
+			our_mm_free(possibleFreeBlock + 1);
+			return possibleFreeBlock + leftOverSize + 1;
+		}
 		else
 		{
 			setMetas(possibleFreeBlock, newsize, 1);
@@ -255,37 +1592,41 @@ int *our_mm_malloc(size_t size)
 		return possibleFreeBlock + 1;
 	}
 
-	while (heap_size - (size_t)(current_heap - beginning) * WORD_SIZE < newsizeInBytes)
+	while (heap->heap_size - (size_t)(heap->current_heap - heap->beginning) * WORD_SIZE < newsizeInBytes)
 	{
-		void *allocation = mem_sbrk(newsizeInBytes);
+		// only what the top of the heap lacks : after mm_compact trimmed it, the top is tight
+		size_t missing = newsizeInBytes - (heap->heap_size - (size_t)(heap->current_heap - heap->beginning) * WORD_SIZE);
+		void *allocation = mem_sbrk_in(heap->mem, missing);
 		if (allocation == (void *)-1)
 		{
-			printf("\n\nbeginning    : %p\n", beginning);
-			printf("current_heap : %p\n", current_heap);
-			printf("heap_end     : %p\n", heap_end);
-			printf("heap_size    : %d\n", heap_size);
-			printf("comparison : %d < %d ?\n", heap_size - (size_t)(current_heap - beginning) * WORD_SIZE, newsizeInBytes);
+#if MM_DIAGNOSTICS
+			diag("\n\nbeginning    : %p\n", heap->beginning);
+			diag("current_heap : %p\n", heap->current_heap);
+			diag("heap_end     : %p\n", heap->heap_end);
+			diag("heap_size    : %zu\n", heap->heap_size);
+			diag("comparison : %zu < %zu ?\n", heap->heap_size - (size_t)(heap->current_heap - heap->beginning) * WORD_SIZE, newsizeInBytes);
 			int BiggestFoundSize = -1;
 			int *freeBlock = (int *)0;
 			findBigestFreeSpace(&BiggestFoundSize, &freeBlock);
-			printf("Biggest free block found at %p with size %d\n", freeBlock, BiggestFoundSize);
+			diag("Biggest free block found at %p with size %d\n", freeBlock, BiggestFoundSize);
+#endif
 
 			return NULL;
 		}
 		update_heap_end();
-		heap_size = mem_heapsize();
+		heap->heap_size = mem_heapsize_in(heap->mem);
 	}
 	
-	if (heap_size - (size_t)(current_heap - beginning) * WORD_SIZE >= newsizeInBytes)
+	if (heap->heap_size - (size_t)(heap->current_heap - heap->beginning) * WORD_SIZE >= newsizeInBytes)
 	{
-		block = current_heap;
-		current_heap += newsize;	
+		block = heap->current_heap;
+		heap->current_heap += newsize;	
 	}
 	
 	else
 	{
 		//being not polite helps programmer reach a true state of creativity
-		printf("GROS NAZE \n");
+		diag("GROS NAZE \n");
 	}
 	
     if (block == (void *)-1)
@@ -307,6 +1648,10 @@ int *our_mm_malloc(size_t size)
  */
 void mm_free(void *blockPtr)
 {
+	if (profileLiveCount != 0)
+	{
+		profileFree(blockPtr);
+	}
 	our_mm_free((int *)blockPtr);
 }
 
@@ -326,7 +1671,7 @@ void our_mm_free(int *blockPtr)
 
 	if (!isMetaValid(startMeta))
 	{
-		printf("Invalid meta to free...");
+		diag("Invalid meta to free...");
 		return;
 	}
 	int *endMeta = getEndMeta(startMeta);
@@ -335,7 +1680,7 @@ void our_mm_free(int *blockPtr)
 	
 	// --- NEXT BLOCK ---
 	//check next block in memory
-	if (endMeta < current_heap - 1 && getStatusBit(endMeta + 1) == 0)
+	if (endMeta < heap->current_heap - 1 && getStatusBit(endMeta + 1) == 0)
 	{
 		int *nextBlockMeta = endMeta + 1;
 	  	//printf("\tcoalescing with next ");
@@ -344,9 +1689,9 @@ void our_mm_free(int *blockPtr)
 
 		//printf("total size = %d, nextblockSize = %d, current size = %d \n",totalSize, getSize(nextBlockMeta), getSize(startMeta) );
 
-		if (abs(totalSize) > heap_size || totalSize <= 0)
+		if (abs(totalSize) > heap->heap_size || totalSize <= 0)
 		{
-			printf("Probleme de size : heap size = %d \n", heap_size);
+			diag("Probleme de size : heap size = %zu \n", heap->heap_size);
 			return;
 		}
 
@@ -362,7 +1707,7 @@ void our_mm_free(int *blockPtr)
 
 	// --- PREV BLOCK ---
 	//check prev block in memory
-	if (startMeta > beginning + 1 && getStatusBit(startMeta - 1) == 0)
+	if (startMeta > heap->beginning + 1 && getStatusBit(startMeta - 1) == 0)
 	{
 		int *prevBlockEndMeta = startMeta - 1;
 		//previus block is free -> coalescing
@@ -370,14 +1715,14 @@ void our_mm_free(int *blockPtr)
 		
 		//printf("total size = %d, prevblockSize = %d, current size = %d \n",totalSize, getSize(prevBlockEndMeta), getSize(startMeta) );
 
-		if (abs(totalSize) > heap_size || totalSize <= 0)
+		if (abs(totalSize) > heap->heap_size || totalSize <= 0)
 		{
-			printf("Probleme de size...\n");
+			diag("Probleme de size...\n");
 			return;
 		}
 
 		startMeta = startMeta - getSize(prevBlockEndMeta);
-		if (startMeta > beginning)
+		if (startMeta > heap->beginning)
 		{
 			glog("Coalescing with previous %p", startMeta);
 			setMetas(startMeta, totalSize, 0);	
@@ -387,11 +1732,12 @@ void our_mm_free(int *blockPtr)
 
 	setStatusBit(startMeta, 0);
 	setStatusBit(endMeta, 0);
+	bitmapSet(heap->allocBits, granuleOf(startMeta), 0);
 
-	if (startMeta + getSize(startMeta) == current_heap)
+	if (startMeta + getSize(startMeta) == heap->current_heap)
 	{
 		//printf("current_heap took from %p to %p\n", current_heap, startMeta);
-		current_heap = startMeta;
+		heap->current_heap = startMeta;
 	}
 	//printf("\t endOf Coal %p -> %p ", startMeta, endMeta);
 	else
@@ -409,39 +1755,76 @@ void our_mm_free(int *blockPtr)
 }
 
 /*
- * mm_realloc - Wrapper
- * handles only basic opeations, otherwise call our_mm_realloc
+ * mm_realloc - Wrapper
+ * handles only basic opeations, otherwise call our_mm_realloc
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+	return mm_realloc_aligned(ptr, size, ALIGNMENT);
+}
+
+/*
+ * mm_realloc_aligned - mm_realloc whose block, if it has to move, lands on
+ * "alignment" bytes (a power of two) : ptr must be aligned on them already
  */
-void *mm_realloc(void *ptr, size_t size)
+void *mm_realloc_aligned(void *ptr, size_t size, size_t alignment)
 {
 	if (ptr == NULL)
 	{
-		return mm_malloc(size);
+		return mm_memalign(alignment, size);
 	}
 	else if (size == 0)
 	{
 		mm_free(ptr);
 		return ptr;
 	}
-	return (void *)our_mm_realloc((int *)ptr, size);
+	if (profileRate == 0 && profileLiveCount == 0)
+	{
+		return (void *)our_mm_realloc((int *)ptr, size, alignment);
+	}
+	// the old block dies, a block of the new size is born
+	void *newPtr = (void *)our_mm_realloc((int *)ptr, size, alignment);
+	if (newPtr != NULL)
+	{
+		profileFree(ptr);
+		if (profileRate != 0)
+		{
+			profileAlloc(newPtr, size);
+		}
+	}
+	return newPtr;
 }
 
 /**
  * core realloc function
  * strategy is given on top of file
+ * a block resized in place keeps the alignment of ptr, a moved one is aligned on "alignment"
  */
-int *our_mm_realloc(int *ptr, size_t size)
+int *our_mm_realloc(int *ptr, size_t size, size_t alignment)
 {
     int *oldptr = ptr - 1;
     int *newptr = oldptr;
     size_t copySize;
     
+#if MM_SIZE_CLASSES
+	size_t askedSize = ((ALIGN(roundToSizeClass(size))) / WORD_SIZE + 2);
+#else
 	size_t askedSize = ((ALIGN(size)) / WORD_SIZE + 2);
+#endif
     
     size_t oldSize = getSize(oldptr);
     
 	if (oldSize >= askedSize)
 	{
+		// give the tail back, unless the block only shrinks by a little
+		size_t excess = oldSize - askedSize;
+		if (excess >= 4 && excess * WORD_SIZE >= reallocSlack)
+		{
+			setMetas(oldptr, askedSize, 1);
+			setMetas(oldptr + askedSize, excess, 1);
+			our_mm_free(oldptr + askedSize + 1);
+			shrinkCount++;
+		}
 		return ptr;
 	}
 
@@ -461,9 +1844,10 @@ int *our_mm_realloc(int *ptr, size_t size)
 	    	int remainingFreeSpace = oldSize + nextBlockSize - askedSize;
 			if (remainingFreeSpace > 3)
 			{
+				setMetas(newptr, askedSize, 1);
 				int *nextFreeMetaBlock = newptr + getSize(newptr);
 	      		setMetas(nextFreeMetaBlock, remainingFreeSpace, 1);
-				our_mm_free(nextFreeMetaBlock);
+				our_mm_free(nextFreeMetaBlock + 1);
 	    	}
 			//if(!mm_check()){printf("Heap inconsistent\n");}
 	    	return (newptr + 1);
@@ -472,21 +1856,272 @@ int *our_mm_realloc(int *ptr, size_t size)
     
     
     //printf("We had to add at the end... \n");
-    newptr = our_mm_malloc(size);
+    newptr = our_mm_memalign(alignment, size);
     
     if (newptr == NULL)
       return NULL;
     
 	copySize = (getSize(oldptr) - 2) * WORD_SIZE;
     if (size < copySize)
-		copySize = 8 * (ALIGN(size) / WORD_SIZE);
-	memcpy((void *)newptr, (void *)(oldptr + 1), copySize);
+		copySize = WORD_SIZE * (ALIGN(size) / WORD_SIZE);
+	copyPayload((void *)newptr, (void *)(oldptr + 1), copySize);
 
 	our_mm_free(oldptr + 1);
 	//if(!mm_check()){printf("Here is more shit...\n");}
     return newptr;
 }
 
+/*
+ * mm_memalign - Wrapper
+ * alignment must be a power of two
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+	void *allocatedPtr = (void *)our_mm_memalign(alignment, size);
+	if (profileRate != 0)
+	{
+		profileAlloc(allocatedPtr, size);
+	}
+	return allocatedPtr;
+}
+
+/**
+ * Allocates a block whose payload is aligned on "alignment" bytes
+ * We take a block large enough to contain the payload after any misalignment,
+ * then give back what lies in front of the aligned payload (at least 4 words, so
+ * that it makes a valid free block) and what is left after it.
+ */
+int *our_mm_memalign(size_t alignment, size_t size)
+{
+	if (alignment <= ALIGNMENT)
+	{
+		return our_mm_malloc(size);
+	}
+
+	int *ptr = our_mm_malloc(size + alignment + 4 * WORD_SIZE);
+	if (ptr == NULL)
+	{
+		return NULL;
+	}
+
+	uintptr_t address = (uintptr_t)ptr;
+	if (address % alignment != 0)
+	{
+		uintptr_t alignedAddress = (address + 4 * WORD_SIZE + alignment - 1) & ~(uintptr_t)(alignment - 1);
+		int leadingSize = (int)((alignedAddress - address) / WORD_SIZE);
+		int *meta = ptr - 1;
+		int totalSize = getSize(meta);
+
+		setMetas(meta + leadingSize, totalSize - leadingSize, 1);
+		setMetas(meta, leadingSize, 1);
+		our_mm_free(meta + 1);
+		ptr = (int *)alignedAddress;
+	}
+
+	int *meta = ptr - 1;
+	int neededSize = ALIGN(size) / WORD_SIZE + 2;
+	int remainingSize = getSize(meta) - neededSize;
+	if (remainingSize > 3)
+	{
+		setMetas(meta, neededSize, 1);
+		setMetas(meta + neededSize, remainingSize, 1);
+		our_mm_free(meta + neededSize + 1);
+	}
+	return ptr;
+}
+
+/*
+ * mm_usable_size - number of payload bytes actually available at ptr
+ */
+size_t mm_usable_size(void *ptr)
+{
+	return (getSize(getStartMeta((int *)ptr - 1)) - 2) * WORD_SIZE;
+}
+
+/*
+ * mm_probes - number of blocks examined while searching free space so far
+ */
+unsigned long mm_probes(void)
+{
+	return probeCount;
+}
+
+/*
+ * mm_realloc_shrinks - number of reallocs that gave the tail of their block back so far
+ */
+unsigned long mm_realloc_shrinks(void)
+{
+	return shrinkCount;
+}
+
+/*
+ * mm_set_realloc_slack - a shrinking realloc keeps tails smaller than bytes
+ */
+void mm_set_realloc_slack(size_t bytes)
+{
+	reallocSlack = bytes;
+}
+
+/*
+ * mm_set_copy_threshold - realloc moves of at least bytes use non-temporal stores
+ * returns the previous threshold
+ */
+size_t mm_set_copy_threshold(size_t bytes)
+{
+	size_t previous = ntThreshold;
+	ntThreshold = bytes;
+	return previous;
+}
+
+/*
+ * mm_copy_kernel - name of the kernel of large realloc moves on this CPU
+ */
+const char *mm_copy_kernel(void)
+{
+	pickCopyKernel();
+	return largeCopyName;
+}
+
+/**
+ * memcpy, as a copy kernel
+ */
+void copyPlain(void *dst, const void *src, size_t bytes)
+{
+	memcpy(dst, src, bytes);
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+/**
+ * Non-temporal copy, 32 bytes at a time : memcpy brings dst 32-byte aligned, unaligned loads
+ * read src, streaming stores write dst without allocating its lines in the cache
+ */
+__attribute__((target("avx2"))) void copyStreamAvx2(void *dst, const void *src, size_t bytes)
+{
+	char *d = (char *)dst;
+	const char *s = (const char *)src;
+	size_t head = (32 - ((uintptr_t)d & 31)) & 31;
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	bytes -= head;
+
+	for (; bytes >= 128; bytes -= 128, d += 128, s += 128)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i *)s);
+		__m256i b = _mm256_loadu_si256((const __m256i *)(s + 32));
+		__m256i c = _mm256_loadu_si256((const __m256i *)(s + 64));
+		__m256i e = _mm256_loadu_si256((const __m256i *)(s + 96));
+		_mm256_stream_si256((__m256i *)d, a);
+		_mm256_stream_si256((__m256i *)(d + 32), b);
+		_mm256_stream_si256((__m256i *)(d + 64), c);
+		_mm256_stream_si256((__m256i *)(d + 96), e);
+	}
+	// streaming stores are weakly ordered : make them visible before the block is used
+	_mm_sfence();
+	memcpy(d, s, bytes);
+}
+
+/**
+ * Same as copyStreamAvx2, 16 bytes at a time, for CPUs without AVX2
+ */
+__attribute__((target("sse2"))) void copyStreamSse2(void *dst, const void *src, size_t bytes)
+{
+	char *d = (char *)dst;
+	const char *s = (const char *)src;
+	size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	bytes -= head;
+
+	for (; bytes >= 64; bytes -= 64, d += 64, s += 64)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)s);
+		__m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+		__m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+		__m128i e = _mm_loadu_si128((const __m128i *)(s + 48));
+		_mm_stream_si128((__m128i *)d, a);
+		_mm_stream_si128((__m128i *)(d + 16), b);
+		_mm_stream_si128((__m128i *)(d + 32), c);
+		_mm_stream_si128((__m128i *)(d + 48), e);
+	}
+	_mm_sfence();
+	memcpy(d, s, bytes);
+}
+#endif
+
+/**
+ * chooses the kernel of large copies from the CPUID flags, once
+ */
+void pickCopyKernel()
+{
+	if (largeCopy != NULL)
+	{
+		return;
+	}
+	largeCopy = copyPlain;
+#if defined(__i386__) || defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		largeCopy = copyStreamAvx2;
+		largeCopyName = "avx2-nt";
+	}
+	else if (__builtin_cpu_supports("sse2"))
+	{
+		largeCopy = copyStreamSse2;
+		largeCopyName = "sse2-nt";
+	}
+#endif
+}
+
+/**
+ * copies a payload moved by realloc
+ * blocks that fit in the cache go through memcpy, larger ones through the non-temporal kernel
+ */
+void copyPayload(void *dst, const void *src, size_t bytes)
+{
+	// below a few vectors, aligning dst would cost more than streaming saves
+	if (bytes < ntThreshold || bytes < 256)
+	{
+		memcpy(dst, src, bytes);
+		return;
+	}
+	pickCopyKernel();
+	largeCopy(dst, src, bytes);
+}
+
+/**
+ * Rounds a request up to the smallest size class holding it
+ * 
+ * @param size:size_t requested size in bytes
+ * @return the size of the class, or size itself if it is larger than every class
+ */
+size_t roundToSizeClass(size_t size)
+{
+	int low = 0;
+	int high = MM_NUM_SIZE_CLASSES;
+
+	if (size > mm_size_classes[MM_NUM_SIZE_CLASSES - 1])
+	{
+		return size;
+	}
+	//binary search of the first class >= size
+	while (low < high)
+	{
+		int middle = (low + high) / 2;
+		if (mm_size_classes[middle] < size)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	return mm_size_classes[low];
+}
+
 //////////////////////////////////////////////////////////////////////
 //
 // The set of helper functions
@@ -508,27 +2143,27 @@ bool putFreeBlockInFreeList(int *startMeta)
 	int freesize = getSize(startMeta);
 	if (freesize < 4)
 	{
-		printf("The free block is really too small : %d.\n", freesize);
+		diag("The free block is really too small : %d.\n", freesize);
 		return false;
 	}
 
 	// There are four possibilities : adding the first one,  adding at the beginning, 
 	// adding at the end, or adding in the middle of the list.
 
-	if (*beginning == 0)
+	if (*heap->beginning == 0)
 	{
 		// This means that no free block is available, this is the first one.
-		int firstFreeSpace = (int)(startMeta - beginning);
+		int firstFreeSpace = (int)(startMeta - heap->beginning);
 		if (firstFreeSpace > 0)
 		{
-			*beginning = firstFreeSpace;
+			*heap->beginning = firstFreeSpace;
 			setPreviousFree(startMeta, firstFreeSpace);
 			setNextFree(startMeta, 0);
 			return true;
 		}
 		else
 		{
-			printf("firstFreeSpace has negative offset\n");
+			diag("firstFreeSpace has negative offset\n");
 			return false;
 		}
 	}
@@ -537,7 +2172,7 @@ bool putFreeBlockInFreeList(int *startMeta)
 		// This means there is already one free block. First we try to find one after this one.
 		int *currentPtr = startMeta + freesize;
 		int *nextFreeMeta = (int *)0;
-		while (currentPtr < current_heap)
+		while (currentPtr < heap->current_heap)
 		{
 			int size = getSize(currentPtr);
 			if (getStatusBit(currentPtr) == 0)
@@ -548,7 +2183,7 @@ bool putFreeBlockInFreeList(int *startMeta)
 			currentPtr += size;
 			if (size <= 0)
 			{
-				printf("size is not really positive... \n");
+				diag("size is not really positive... \n");
 				return false;
 			}
 		}
@@ -560,9 +2195,9 @@ bool putFreeBlockInFreeList(int *startMeta)
 			// Lets go backward to the previous free block then... No other choice, for now.
 			
 			currentPtr = startMeta;
-			int *previousFreeMeta = beginning;
+			int *previousFreeMeta = heap->beginning;
 			//printf("Starting countdown\n");
-			while (currentPtr > beginning + 1)
+			while (currentPtr > heap->beginning + 1)
 			{	
 				//printf("%p\n", currentPtr);
 				int size = getSize(currentPtr - 1);
@@ -574,16 +2209,16 @@ bool putFreeBlockInFreeList(int *startMeta)
 				currentPtr -= size;
 				if (size <= 0)
 				{
-					printf("size is not positive : %d... \n", size);
+					diag("size is not positive : %d... \n", size);
 					return false;
 				}
 			}
-			if (previousFreeMeta == beginning)
+			if (previousFreeMeta == heap->beginning)
 			{
 				//This is not supposed to happen, this case should have been handled before...
-				printf("*Beginning == %d but no free space found \n", *beginning);
+				diag("*Beginning == %d but no free space found \n", *heap->beginning);
 				mm_check();
-				printf("There are %d free blocks\n", numberOfFree);
+				diag("There are %d free blocks\n", numberOfFree);
 				return false;
 			}
 			else
@@ -604,19 +2239,19 @@ bool putFreeBlockInFreeList(int *startMeta)
 				setNextFree(startMeta, DIFF_PTRS_IN_WORD(nextFreeMeta, startMeta));
 				setPreviousFree(nextFreeMeta, DIFF_PTRS_IN_WORD(nextFreeMeta, startMeta));
 
-				if (previousFreeMeta != beginning)
+				if (previousFreeMeta != heap->beginning)
 				{
 					setNextFree(previousFreeMeta, DIFF_PTRS_IN_WORD(startMeta, previousFreeMeta));
 				}
 				else
 				{
-					*beginning = DIFF_PTRS_IN_WORD(startMeta, previousFreeMeta);
+					*heap->beginning = DIFF_PTRS_IN_WORD(startMeta, previousFreeMeta);
 				}
 				return true;
 			}
 			else
 			{
-				printf("nextFreeMeta isn't valid... : %p %p -> %d\n", startMeta, nextFreeMeta, getSize(nextFreeMeta));
+				diag("nextFreeMeta isn't valid... : %p %p -> %zu\n", startMeta, nextFreeMeta, getSize(nextFreeMeta));
 				return false;
 			}
 		}
@@ -634,7 +2269,7 @@ bool takeFreeBlockOutOfTheList(int *startMeta)
 	int freesize = getSize(startMeta);
 	if (freesize < 4)
 	{
-		printf("The free block is too small : %d.\n", freesize);
+		diag("The free block is too small : %d.\n", freesize);
 		return false;
 	}
 
@@ -652,20 +2287,20 @@ bool takeFreeBlockOutOfTheList(int *startMeta)
 		{
 			setPreviousFree(nextFreeBlock, getPreviousFreeOffset(nextFreeBlock) + previousFreeOffset);
 			int *previousFreeBlock = startMeta - previousFreeOffset;
-			if (previousFreeBlock != beginning)
+			if (previousFreeBlock != heap->beginning)
 			{
 				setNextFree(previousFreeBlock, getNextFreeOffset(previousFreeBlock) + nextFreeOffset);
 			}
 			else
 			{
-				*beginning = getNextFreeOffset(previousFreeBlock) + nextFreeOffset;
+				*heap->beginning = getNextFreeOffset(previousFreeBlock) + nextFreeOffset;
 			}
 			return true;
 		}
 		else
 		{
 			//This shouldn't happen 
-			printf("This shouldn't happen \n");
+			diag("This shouldn't happen \n");
 			return false;
 		}
 	}
@@ -674,20 +2309,20 @@ bool takeFreeBlockOutOfTheList(int *startMeta)
 		if (previousFreeOffset != 0)
 		{
 			int *previousFreeBlock = startMeta - previousFreeOffset;
-			if (previousFreeBlock != beginning)
+			if (previousFreeBlock != heap->beginning)
 			{
 				setNextFree(previousFreeBlock, 0);
 			}
 			else
 			{
-				*beginning = 0;
+				*heap->beginning = 0;
 			}
 			return true;
 		}
 		else
 		{
 			//This shouldn't happen 
-			printf("This shouldn't happen \n");
+			diag("This shouldn't happen \n");
 			return false;
 		}
 	}
@@ -741,11 +2376,12 @@ bool isMetaValid(int *meta)
 {
 	int *endMeta = getSize(meta) + meta;
 	//printf("%d\n",getSize(meta));
-	if (meta <= beginning || meta >= heap_end)
+	if (meta <= heap->beginning || meta >= heap->heap_end)
 	{
 		return false;
 	}
-	if (endMeta <= beginning || endMeta >= heap_end)
+	// endMeta is the meta following the block : it may be current_heap itself
+	if (endMeta <= heap->beginning || endMeta > heap->current_heap)
 	{
 		return false;
 	}
@@ -756,6 +2392,25 @@ bool isMetaValid(int *meta)
 	return true;
 }
 
+#if MM_PREFETCH
+/**
+ * starts loading the meta of the block after nextPtr, two blocks ahead of the search :
+ * nextPtr itself was requested one step earlier, so its size is cheap to read
+ */
+static inline void prefetchAfter(int *nextPtr)
+{
+	if (nextPtr >= heap->current_heap)
+	{
+		return;
+	}
+	int nextSize = getSize(nextPtr);
+	if (nextSize > 0 && nextPtr + nextSize < heap->current_heap)
+	{
+		__builtin_prefetch(nextPtr + nextSize);
+	}
+}
+#endif
+
 /**
  * Basic space finder
  * finds first free blocks that is large enough to contains the requested size
@@ -764,24 +2419,70 @@ bool isMetaValid(int *meta)
 bool findFirstFreeSpace(size_t size, int **freeBlock)
 {
 
-	int* currentPtr = beginning + 1;
+	int* currentPtr = heap->beginning + 1;
+	// counted locally and added once : the per probe cost stays out of the loop
+	unsigned long probes = 0;
+	bool found = false;
 
-	while(current_heap > currentPtr)
+	while(heap->current_heap > currentPtr)
 	{
 		int available_size = getSize(currentPtr);
+		probes++;
 		if (available_size >= size && getStatusBit(currentPtr) == 0)
 		{
 			*freeBlock = currentPtr;
 			//printf("available_size = %d and free = %d at ptr = %p\n", available_size, getStatusBit(currentPtr), currentPtr);
-
-			return true;
+			found = true;
+			break;
 		}
 		if (available_size <= 0)
 		{
-			return false;
+			break;
 		}
 		currentPtr += available_size;
+#if MM_PREFETCH
+		prefetchAfter(currentPtr);
+#endif
+	}
+	probeCount += probes;
+	return found;
+}
+
+/**
+ * finds the highest free block large enough, walking the side bitmaps down from the top :
+ * short-lived blocks gather near the top of the heap, where their frees coalesce into it
+ */
+bool findLastFreeSpace(size_t size, int **freeBlock)
+{
+	size_t end = granuleOf(heap->current_heap);
+	unsigned long probes = 0;
+	if (end == 0)
+	{
+		return false;
+	}
+	for (size_t w = (end - 1) / BITS_PER_LONG + 1; w-- > 0;)
+	{
+		unsigned long frees = heap->startBits[w] & ~heap->allocBits[w];
+		if (w == (end - 1) / BITS_PER_LONG && end % BITS_PER_LONG != 0)
+		{
+			// starts left beyond current_heap by a shrink are not blocks
+			frees &= (1UL << (end % BITS_PER_LONG)) - 1;
+		}
+		while (frees != 0)
+		{
+			int bit = BITS_PER_LONG - 1 - __builtin_clzl(frees);
+			frees &= ~(1UL << bit);
+			int *meta = heap->beginning + 1 + 2 * (w * BITS_PER_LONG + bit);
+			probes++;
+			if (getSize(meta) >= size)
+			{
+				*freeBlock = meta;
+				probeCount += probes;
+				return true;
+			}
+		}
 	}
+	probeCount += probes;
 	return false;
 }
 
@@ -792,26 +2493,45 @@ bool findFirstFreeSpace(size_t size, int **freeBlock)
 bool findFirstFreeSpaceInExplicitList(size_t size, int** freeBlock)
 {
 
-	int* currentPtr = beginning + *beginning;
-	if(current_heap == beginning)
+	int* currentPtr = heap->beginning + *heap->beginning;
+	if(heap->current_heap == heap->beginning)
 	{
 		return false;
 	}
 
-	while(current_heap > currentPtr && getStatusBit(currentPtr) == 0)
+	unsigned long probes = 0;
+	bool found = false;
+	while(heap->current_heap > currentPtr && getStatusBit(currentPtr) == 0)
 	{
 		int available_size = getSize(currentPtr);
+		probes++;
+#if MM_PREFETCH
+		// the next block was prefetched one step earlier, so its NEXT word is
+		// cheap to read : use it to start loading the block after it
+		int prefetchOffset = getNextFreeOffset(currentPtr);
+		if (prefetchOffset > 0)
+		{
+			int *nextPtr = currentPtr + prefetchOffset;
+			__builtin_prefetch(nextPtr);
+			int nextNextOffset = getNextFreeOffset(nextPtr);
+			if (nextNextOffset > 0 && nextPtr + nextNextOffset < heap->current_heap)
+			{
+				__builtin_prefetch(nextPtr + nextNextOffset);
+			}
+		}
+#endif
 		if(available_size >= size){
 			*freeBlock = currentPtr;
 			//printf("available_size = %d and free = %d at ptr = %p\n", available_size, getStatusBit(currentPtr), currentPtr);
-
-			return true;
+			found = true;
+			break;
 		}
 		int nextFreeBlockOffset = getNextFreeOffset(currentPtr);
-		if(nextFreeBlockOffset <= 0){return false;}
+		if(nextFreeBlockOffset <= 0){break;}
 		currentPtr += nextFreeBlockOffset;
 	}
-	return false;
+	probeCount += probes;
+	return found;
 }
 
 
@@ -823,11 +2543,13 @@ bool findBestFreeSpace(size_t size, int** freeBlock)
 {
 	bool foundAtLeastOne = false;
 	int currentSize = 0;
-	int* currentPtr = beginning + 1;
+	int* currentPtr = heap->beginning + 1;
+	unsigned long probes = 0;
 
-	while ((void *)current_heap - (void *)currentPtr > 0)
+	while ((void *)heap->current_heap - (void *)currentPtr > 0)
 	{
 		int available_size = getSize(currentPtr);
+		probes++;
 		if (available_size >= size && (!foundAtLeastOne || currentSize > available_size) && getStatusBit(currentPtr) == 0)
 		{
 			*freeBlock = currentPtr;
@@ -836,15 +2558,21 @@ bool findBestFreeSpace(size_t size, int** freeBlock)
 			//printf("available_size = %d and free = %d at ptr = %p\n", available_size, getStatusBit(currentPtr), currentPtr);
 			if (available_size == size)
 			{
-				return true;
+				break;
 			}
 		}
 		if (available_size <= 0)
 		{
-			return false;
+			// a corrupted size ends the walk without a block
+			foundAtLeastOne = false;
+			break;
 		}
 		currentPtr += available_size;
+#if MM_PREFETCH
+		prefetchAfter(currentPtr);
+#endif
 	}
+	probeCount += probes;
 	if (foundAtLeastOne)
 	{
 		return true;
@@ -854,56 +2582,80 @@ bool findBestFreeSpace(size_t size, int** freeBlock)
 
 /**
  * find the biggest space available
- * this function isn't used by the driver : it served as a test
+ * sweeps the side bitmaps : the heap itself is not touched
  */
 void findBigestFreeSpace(int *mysize, int **freeBlock)
 {
-	int* currentPtr = beginning+1;
-	int currentSize = 0;
+	mm_stats_t stats;
+	mm_stats(&stats);
+	if (stats.largest_free > 0)
+	{
+		*mysize = stats.largest_free / WORD_SIZE;
+		*freeBlock = heap->beginning + 1 + 2 * stats.largest_free_granule;
+	}
+}
 
-	//printf("%p\n", currentPtr);
-	//printf("%d free on %d\n", numberOfFree, totalAlloc + numberOfFree);
+/*
+ * mm_stats - free space accounting of the current heap, from the side bitmaps
+ */
+void mm_stats(mm_stats_t *stats)
+{
+	size_t end = granuleOf(heap->current_heap);
+	size_t words = (end + BITS_PER_LONG - 1) / BITS_PER_LONG;
 
-	while ((void *)currentPtr < (void *)current_heap)
+	memset(stats, 0, sizeof(mm_stats_t));
+	for (size_t w = 0; w < words; w++)
 	{
-		int available_size = getSize(currentPtr);
-		//printf("available_size = %d and free = %d\n", available_size, getStatusBit(currentPtr));
-		if (available_size > currentSize && getStatusBit(currentPtr) == 0)
+		unsigned long starts = heap->startBits[w];
+		unsigned long occupied = heap->allocBits[w];
+		if (w == words - 1 && end % BITS_PER_LONG != 0)
 		{
-			// There is Mr. "free space" ! Let's greet him !
-			printf("HELLO\n");
-
-			currentSize = available_size;
-			*freeBlock = currentPtr;
-			*mysize = currentSize;
+			// starts left beyond current_heap by a shrink are not blocks
+			starts &= (1UL << (end % BITS_PER_LONG)) - 1;
 		}
-		if (available_size <= 0)
+
+		unsigned long frees = starts & ~occupied;
+		stats->alloc_blocks += __builtin_popcountl(starts & occupied);
+		stats->free_blocks += __builtin_popcountl(frees);
+
+		while (frees != 0)
 		{
-			return;
+			size_t granule = w * BITS_PER_LONG + __builtin_ctzl(frees);
+			size_t bytes = (bitmapNextStart(granule + 1, end) - granule) * 2 * WORD_SIZE;
+			stats->free_bytes += bytes;
+			if (bytes > stats->largest_free)
+			{
+				stats->largest_free = bytes;
+				stats->largest_free_granule = granule;
+			}
+			frees &= frees - 1;
 		}
-		currentPtr += available_size;
 	}
 }
 
-
 /**
  * Heap consistency checker
- * Checks two things : 
+ * Checks three things : 
  *  - if there are two adjacent free blocks
  *  - if the size is the same in the startmeta and in the endMeta for each block
+ *  - if the side bitmaps agree with the metas
  * It also counts the number of free blocks and of occupied blocks. Useful for debugging
+ * Blocks are found from the bitmaps, so a broken meta cannot derail the walk.
  */ 
 bool mm_check()
 {
-	int *currentPtr = beginning + 1;
-	int occupation = getStatusBit(currentPtr) ^ 1;
+	size_t end = granuleOf(heap->current_heap);
+	size_t granule = bitmapNextStart(0, end);
+	int previousFree = 0;
 	numberOfFree = 0;
 	totalAlloc = 0;
-	while (currentPtr < current_heap)
+	while (granule < end)
 	{
+		size_t next = bitmapNextStart(granule + 1, end);
+		int *currentPtr = heap->beginning + 1 + 2 * granule;
 		int available_size = getSize(currentPtr);
-		int newoccupation = getStatusBit(currentPtr);
-		if (newoccupation == 0)
+		int occupied = (heap->allocBits[granule / BITS_PER_LONG] >> (granule % BITS_PER_LONG)) & 1;
+		if (occupied == 0)
 		{
 			numberOfFree += 1;
 		}
@@ -911,20 +2663,26 @@ bool mm_check()
 		{
 			totalAlloc += 1;
 		}
-		if (newoccupation == occupation && occupation == 0)
+		if (occupied == 0 && previousFree)
+		{
+			diag("DEBUG : two succesive blocks are free\n");
+			return false;
+		}
+
+		if (available_size != 2 * (int)(next - granule) || occupied != getStatusBit(currentPtr))
 		{
-			printf("DEBUG : two succesive blocks are free\n");
+			diag("DEBUG : bitmaps and metas not matching... \n");
 			return false;
 		}
 
 		if (available_size != getSize(currentPtr + available_size - 1))
 		{
-			printf("DEBUG : Beginning and Ending meta not matching... \n");
+			diag("DEBUG : Beginning and Ending meta not matching... \n");
 			return false;
 		}
 
-		occupation = newoccupation;
-		currentPtr += available_size;
+		previousFree = (occupied == 0);
+		granule = next;
 	}
 	//printf("number of free :%d and occupied ; %d \n", numberOfFree, totalAlloc);
 	return true;
@@ -939,7 +2697,7 @@ bool setMetas(int *meta, int size, int status)
 	{
 		return false;
 	}
-	if (meta < beginning || (meta + size) > current_heap || (meta + size) < meta)
+	if (meta < heap->beginning || (meta + size) > heap->current_heap || (meta + size) < meta)
 	{
 		return false;
 	}
@@ -949,6 +2707,7 @@ bool setMetas(int *meta, int size, int status)
   
   	setStatusBit(meta, status);
   	setStatusBit(endMeta, status);
+	bitmapMarkBlock(meta, size, status);
   
   return true;
 }
@@ -961,12 +2720,12 @@ bool isNextFree(int *blockPointer, int *nextSize)
 {
 	int *meta = blockPointer;
 	int *nextMeta = meta + getSize(meta);
-	if (nextMeta != current_heap && getStatusBit(nextMeta) == 0)
+	if (nextMeta != heap->current_heap && getStatusBit(nextMeta) == 0)
 	{
 		*nextSize = getSize(nextMeta);
 		return true;
 	}
-	else if (nextMeta == current_heap)
+	else if (nextMeta == heap->current_heap)
 	{
 		*nextSize = -1;
 		return true;
@@ -982,7 +2741,7 @@ bool isNextFree(int *blockPointer, int *nextSize)
 bool isPreviousFree(int *blockPointer, int *previousSize)
 {
 	int *previousMeta = getStartMeta(blockPointer) - 1;
-	if (previousMeta != beginning && getStatusBit(previousMeta) == 0)
+	if (previousMeta != heap->beginning && getStatusBit(previousMeta) == 0)
 	{
 		*previousSize = getSize(previousMeta);
 		return true;
@@ -991,6 +2750,117 @@ bool isPreviousFree(int *blockPointer, int *previousSize)
 	return false;
 }
 
+/**
+ * index of the granule where the block starting at meta begins
+ */
+size_t granuleOf(int *meta)
+{
+	return (size_t)(meta - (heap->beginning + 1)) / 2;
+}
+
+/**
+ * set the bit of a granule to value (0 or 1)
+ */
+void bitmapSet(unsigned long *bits, size_t granule, int value)
+{
+	unsigned long mask = 1UL << (granule % BITS_PER_LONG);
+	if (value)
+	{
+		bits[granule / BITS_PER_LONG] |= mask;
+	}
+	else
+	{
+		bits[granule / BITS_PER_LONG] &= ~mask;
+	}
+}
+
+/**
+ * clear the bits of granules from (included) to to (excluded), a word at a time
+ */
+void bitmapClearRange(unsigned long *bits, size_t from, size_t to)
+{
+	if (from >= to)
+	{
+		return;
+	}
+	size_t firstWord = from / BITS_PER_LONG;
+	size_t lastWord = (to - 1) / BITS_PER_LONG;
+	unsigned long firstMask = ~0UL << (from % BITS_PER_LONG);
+	unsigned long lastMask = ~0UL >> (BITS_PER_LONG - 1 - (to - 1) % BITS_PER_LONG);
+
+	if (firstWord == lastWord)
+	{
+		bits[firstWord] &= ~(firstMask & lastMask);
+		return;
+	}
+	bits[firstWord] &= ~firstMask;
+	for (size_t w = firstWord + 1; w < lastWord; w++)
+	{
+		bits[w] = 0;
+	}
+	bits[lastWord] &= ~lastMask;
+}
+
+/**
+ * record in the side bitmaps a block of size words starting at meta
+ * the granules it covers can no more be block starts
+ */
+void bitmapMarkBlock(int *meta, int size, int status)
+{
+	size_t granule = granuleOf(meta);
+	bitmapClearRange(heap->startBits, granule + 1, granule + size / 2);
+	bitmapSet(heap->startBits, granule, 1);
+	bitmapSet(heap->allocBits, granule, status);
+}
+
+/**
+ * first granule from "from" where a block starts, or end if there is none before end
+ */
+size_t bitmapNextStart(size_t from, size_t end)
+{
+	while (from < end)
+	{
+		unsigned long word = heap->startBits[from / BITS_PER_LONG] >> (from % BITS_PER_LONG);
+		if (word != 0)
+		{
+			from += __builtin_ctzl(word);
+			return (from < end) ? from : end;
+		}
+		from = (from / BITS_PER_LONG + 1) * BITS_PER_LONG;
+	}
+	return end;
+}
+
+/**
+ * first granule from "from" where a free block starts, or end if there is none before end
+ */
+size_t bitmapNextFree(size_t from, size_t end)
+{
+	while (from < end)
+	{
+		size_t w = from / BITS_PER_LONG;
+		unsigned long word = (heap->startBits[w] & ~heap->allocBits[w]) >> (from % BITS_PER_LONG);
+		if (word != 0)
+		{
+			from += __builtin_ctzl(word);
+			return (from < end) ? from : end;
+		}
+		from = (w + 1) * BITS_PER_LONG;
+	}
+	return end;
+}
+
+/**
+ * zeroed storage for a bitmap, out of the heap
+ * pages are only reserved : untouched parts of the bitmap cost nothing
+ */
+unsigned long *bitmapAlloc(size_t words)
+{
+	void *bits = mmap(NULL, words * sizeof(unsigned long), PROT_READ | PROT_WRITE,
+					  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	return (bits == MAP_FAILED) ? NULL : (unsigned long *)bits;
+}
+
 /**
  * return the status bit of a meta word
  */
@@ -1070,3 +2940,17 @@ void glog(const char *format, ...)
         printf("%s\n", out);
 #endif
 }
+
+/*
+ * Diagnostics on an exhausted or inconsistent heap, on stderr
+ * compiled out of libmm.so, where stdout belongs to the host program
+ */
+void diag(const char *format, ...)
+{
+#if MM_DIAGNOSTICS
+	va_list argptr;
+	va_start(argptr, format);
+	vfprintf(stderr, format, argptr);
+	va_end(argptr);
+#endif
+}
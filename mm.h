@@ -1,9 +1,109 @@
 #include <stdio.h>
 
 extern int mm_init (void);
+extern int mm_init_hint(size_t expected_bytes, size_t expected_live_objects);
+extern void mm_reset(int keep_pages);
 extern void *mm_malloc (size_t size);
+extern void *mm_malloc_hint(size_t size, int lifetime);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_realloc_aligned(void *ptr, size_t size, size_t alignment);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern size_t mm_usable_size(void *ptr);
+extern unsigned long mm_probes(void);
+extern unsigned long mm_realloc_shrinks(void);
+extern void mm_set_realloc_slack(size_t bytes);
+extern size_t mm_set_copy_threshold(size_t bytes);
+extern const char *mm_copy_kernel(void);
+
+/*
+ * Sampling heap profiler: mm_malloc, mm_memalign and mm_realloc sample
+ * about one allocation per sample_bytes, with its call stack, until
+ * mm_profile_start(0). mm_profile_dump writes a pprof heap profile of
+ * the space in use and of the space allocated since mm_profile_start.
+ * Threads allocating at once in their own heaps are sampled each on its
+ * own countdown, into one profile.
+ */
+extern int mm_profile_start(size_t sample_bytes);
+extern int mm_profile_dump(FILE *out);
+
+/*
+ * Lifetime hints of mm_malloc_hint. Short-lived blocks are taken from
+ * the top of the heap, long-lived ones first fit from the bottom, so
+ * that the two kinds do not interleave.
+ */
+#define MM_SHORT_LIVED 1
+#define MM_LONG_LIVED 2
+
+/* Free space accounting of the heap, computed from its side bitmaps */
+typedef struct {
+    int alloc_blocks;            /* number of occupied blocks */
+    int free_blocks;             /* number of free blocks */
+    size_t free_bytes;           /* bytes in free blocks, metas included */
+    size_t largest_free;         /* bytes of the biggest free block */
+    size_t largest_free_granule; /* where it starts, in 8-byte granules */
+} mm_stats_t;
+
+extern void mm_stats(mm_stats_t *stats);
+
+/*
+ * Independent heaps. mm_malloc, mm_free and mm_realloc work on a default
+ * heap; each mm_heap_t has its own memory, released at once by
+ * mm_heap_destroy. mm_heap_select makes a heap the one of the calling
+ * thread: threads may allocate at once, each in a heap of its own. A
+ * thread frees a block of another thread's heap with mm_heap_free_remote,
+ * which queues it for the owner to free at its next allocation.
+ */
+typedef struct mm_heap mm_heap_t;
+
+extern mm_heap_t *mm_heap_create(size_t max_bytes);
+extern void *mm_heap_malloc(mm_heap_t *heap, size_t size);
+extern void mm_heap_free(mm_heap_t *heap, void *ptr);
+extern void *mm_heap_realloc(mm_heap_t *heap, void *ptr, size_t size);
+extern void mm_heap_reset(mm_heap_t *heap, int keep_pages);
+extern void mm_heap_destroy(mm_heap_t *heap);
+extern mm_heap_t *mm_heap_select(mm_heap_t *heap);
+extern void mm_heap_free_remote(mm_heap_t *heap, void *ptr);
+
+/*
+ * Regions, for objects that die together. mm_region_alloc bump-allocates
+ * out of chunks taken from the default heap; the objects cannot be freed
+ * one by one, mm_region_reset releases them all.
+ */
+typedef struct mm_region mm_region_t;
+
+extern mm_region_t *mm_region_create(size_t chunk_bytes);
+extern void *mm_region_alloc(mm_region_t *region, size_t size);
+extern void mm_region_reset(mm_region_t *region);
+extern void mm_region_destroy(mm_region_t *region);
+
+/*
+ * Pools of objects of a single size and alignment, taken by slabs from
+ * the default heap. mm_pool_put gives an object back to its pool, for
+ * the next mm_pool_get; mm_pool_destroy releases all the slabs.
+ */
+typedef struct mm_pool mm_pool_t;
+
+extern mm_pool_t *mm_pool_create(size_t object_size, size_t alignment);
+extern void *mm_pool_get(mm_pool_t *pool);
+extern void mm_pool_put(mm_pool_t *pool, void *object);
+extern void mm_pool_destroy(mm_pool_t *pool);
+
+/*
+ * Movable blocks of the default heap, known by a handle (0 is never a
+ * valid one) rather than an address. A block has a stable address only
+ * while pinned; mm_compact may slide the unpinned ones toward the start
+ * of the heap, moving at most budget_bytes per call, and returns the
+ * bytes it moved.
+ */
+typedef unsigned int mm_handle_t;
+
+extern mm_handle_t mm_halloc(size_t size);
+extern void mm_hfree(mm_handle_t handle);
+extern int mm_hrealloc(mm_handle_t handle, size_t size);
+extern void *mm_hpin(mm_handle_t handle);
+extern void mm_hunpin(mm_handle_t handle);
+extern size_t mm_compact(size_t budget_bytes);
 
 
 /* 
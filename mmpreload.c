@@ -0,0 +1,236 @@
+/*
+ * mmpreload.c - exports the libc allocation interface on top of mm.c,
+ *     so that real programs can be run with our allocator:
+ *
+ *         unix> make libmm.so
+ *         unix> LD_PRELOAD=./libmm.so ls -l
+ *
+ *     mm.c works on the default heap of memlib.c, which is built with
+ *     MEM_USE_MMAP so that no call ever goes back to libc malloc.
+ *
+ *     - The package is initialized by the first call, whichever it is:
+ *       the dynamic loader and libc call malloc before any constructor
+ *       of ours has run.
+ *     - A single lock serializes the calls. It is taken around fork, so
+ *       that the child never inherits a heap in the middle of an update.
+ *       It is recursive, in case a call back into libc allocates.
+ *     - On 64-bit targets, libc guarantees 16-byte aligned blocks, while
+ *       mm.c only aligns on 8 bytes, so blocks go through mm_memalign,
+ *       and the blocks realloc moves through mm_realloc_aligned.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define EXPORT __attribute__((visibility("default")))
+
+/* Alignment libc promises for malloc'ed blocks */
+#define MALLOC_ALIGNMENT (2 * sizeof(size_t))
+
+/* Largest request we hand to mm.c (mem_sbrk takes an int) */
+#define MAX_REQUEST ((size_t)1 << 30)
+
+static pthread_mutex_t lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static int initialized = 0;    /* mem_init and mm_init done? */
+static int atfork_done = 0;    /* fork handlers registered? */
+
+/*
+ * fork handlers - keep the lock across fork, and start the child with
+ *     a fresh lock (the other threads, and the owner's id, are gone)
+ */
+static void prepare_fork(void)
+{
+    pthread_mutex_lock(&lock);
+}
+
+static void parent_fork(void)
+{
+    pthread_mutex_unlock(&lock);
+}
+
+static void child_fork(void)
+{
+    pthread_mutex_t fresh = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+    lock = fresh;
+}
+
+/*
+ * enter - take the lock, initializing the package on the first call
+ */
+static void enter(void)
+{
+    pthread_mutex_lock(&lock);
+    if (!initialized) {
+	mem_init();
+	mm_init();
+	initialized = 1;
+    }
+}
+
+/*
+ * leave - release the lock. The fork handlers are registered here, out
+ *     of the lock, because pthread_atfork may itself allocate.
+ */
+static void leave(void)
+{
+    int register_atfork = !atfork_done;
+
+    atfork_done = 1;
+    pthread_mutex_unlock(&lock);
+    if (register_atfork)
+	pthread_atfork(prepare_fork, parent_fork, child_fork);
+}
+
+/*
+ * in_heap - true if ptr was handed out by mm.c. Blocks allocated by the
+ *     loader before we were in place are not ours, and are left alone.
+ */
+static int in_heap(void *ptr)
+{
+    return (char *)ptr >= (char *)mem_heap_lo() &&
+	(char *)ptr <= (char *)mem_heap_hi();
+}
+
+/*
+ * aligned_block - mm_memalign under the lock, with libc's conventions
+ */
+static void *aligned_block(size_t alignment, size_t size)
+{
+    void *p;
+
+    if (size > MAX_REQUEST) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if (size == 0)
+	size = 1;
+    if (alignment < MALLOC_ALIGNMENT)
+	alignment = MALLOC_ALIGNMENT;
+
+    enter();
+    p = mm_memalign(alignment, size);
+    leave();
+
+    if (p == NULL)
+	errno = ENOMEM;
+    return p;
+}
+
+EXPORT void *malloc(size_t size)
+{
+    return aligned_block(MALLOC_ALIGNMENT, size);
+}
+
+EXPORT void free(void *ptr)
+{
+    if (ptr == NULL)
+	return;
+    enter();
+    if (in_heap(ptr))
+	mm_free(ptr);
+    leave();
+}
+
+EXPORT void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (size != 0 && nmemb > MAX_REQUEST / size) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    /* not malloc: gcc would turn malloc + memset back into calloc */
+    if ((p = aligned_block(MALLOC_ALIGNMENT, nmemb * size)) != NULL)
+	memset(p, 0, nmemb * size);
+    return p;
+}
+
+EXPORT void *realloc(void *ptr, size_t size)
+{
+    void *newp;
+
+    if (ptr == NULL)
+	return malloc(size);
+    if (size == 0) {
+	free(ptr);
+	return NULL;
+    }
+    if (size > MAX_REQUEST) {
+	errno = ENOMEM;
+	return NULL;
+    }
+
+    enter();
+    if (!in_heap(ptr)) {
+	/*
+	 * A block of the loader's: its size is unknown, so there is no
+	 * length to copy. It is refused and left in place, as free does.
+	 */
+	leave();
+	errno = ENOMEM;
+	return NULL;
+    }
+    /* moved, the block lands on libc's alignment; ptr stays valid on failure */
+    newp = mm_realloc_aligned(ptr, size, MALLOC_ALIGNMENT);
+    leave();
+    if (newp == NULL)
+	errno = ENOMEM;
+    return newp;
+}
+
+EXPORT void *memalign(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+	errno = EINVAL;
+	return NULL;
+    }
+    return aligned_block(alignment, size);
+}
+
+EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *p;
+
+    if (alignment % sizeof(void *) != 0 ||
+	(alignment & (alignment - 1)) != 0)
+	return EINVAL;
+    if ((p = aligned_block(alignment, size)) == NULL)
+	return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+EXPORT void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+EXPORT void *valloc(size_t size)
+{
+    return aligned_block(mem_pagesize(), size);
+}
+
+EXPORT void *pvalloc(size_t size)
+{
+    size_t pagesize = mem_pagesize();
+    return aligned_block(pagesize, (size + pagesize - 1) & ~(pagesize - 1));
+}
+
+EXPORT size_t malloc_usable_size(void *ptr)
+{
+    size_t size = 0;
+
+    if (ptr == NULL)
+	return 0;
+    enter();
+    if (in_heap(ptr))
+	size = mm_usable_size(ptr);
+    leave();
+    return size;
+}
@@ -0,0 +1,611 @@
+/*
+ * mmrecord.c - records the allocation requests of a real program into
+ *     a tracefile that mdriver replays:
+ *
+ *         unix> make librecord.so
+ *         unix> MM_RECORD=ls.rep LD_PRELOAD=./librecord.so ls -l
+ *         unix> mdriver -f ls.rep
+ *
+ *     malloc, calloc, realloc, free and the memalign family are passed on
+ *     to libc (its __libc_xxx entry points, so that no dlsym is needed
+ *     before the first malloc), and each request is logged as an event.
+ *
+ *     - Each thread logs its events into a ring of its own, which it
+ *       alone writes and a background writer thread alone reads: no lock
+ *       is taken on the allocation path, only an atomic increment of the
+ *       sequence number that orders the events of all the threads.
+ *     - The writer merges the rings by sequence number, names each block
+ *       by an id (a realloc keeps the id of its block), and writes the
+ *       .rep requests, tagged "@n" with the ring of the thread when n is
+ *       not 0. The header is rewritten with the final counts at exit, and
+ *       the blocks still live are freed so that the trace is balanced.
+ *     - An allocation takes its sequence number after libc returns the
+ *       block, a free before libc gets it back, so that a block is never
+ *       reused by another thread before the trace frees it. A realloc
+ *       logs both: the release of the old block and the new block.
+ *     - A thread waits for room in its ring before taking a sequence
+ *       number, never after: the writer may be waiting for that number.
+ *     - Requests made before the library is set up, by the writer, and
+ *       in a child process after fork are not recorded. Frees of blocks
+ *       the trace does not know are dropped. A program that runs others
+ *       records them too: a "%p" in MM_RECORD stands for the pid, so
+ *       that each has a trace of its own.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define EXPORT __attribute__((visibility("default")))
+#define TLS __thread __attribute__((tls_model("initial-exec")))
+
+#define DEFAULT_PATH "mmrecord.rep" /* trace written if MM_RECORD is unset */
+#define MAX_RINGS 256          /* threads recorded at once */
+#define RING_EVENTS 4096       /* events of a ring, a power of 2 */
+#define OUT_BUFFER (1 << 16)   /* bytes the writer gathers per write */
+#define HEADER_WIDTH 11        /* digits of the header counts, rewritten at exit */
+#define WRITER_SLEEP_NS 1000000 /* writer's nap when the rings are empty */
+#define FINAL_NAPS 100         /* naps the writer waits at exit for late events */
+
+/* libc's allocator, under names we do not interpose */
+extern void *__libc_malloc(size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+/* Events of the rings */
+enum {EV_ALLOC, EV_FREE, EV_RELEASE, EV_REALLOC};
+
+typedef struct {
+    uint64_t seq;    /* place of the event in the trace */
+    void *ptr;       /* the block */
+    size_t size;     /* its size, for EV_ALLOC and EV_REALLOC */
+    int type;
+} event_t;
+
+/* Ring states */
+enum {RING_FREE, RING_USED, RING_EXITED};
+
+/* The events of one thread, on their way to the writer */
+typedef struct {
+    volatile int state;
+    event_t *events;           /* RING_EVENTS of them, mmap'ed */
+    volatile uint64_t head;    /* next event the writer reads */
+    volatile uint64_t tail;    /* next event the thread writes */
+} ring_t;
+
+/* Address to id map of the live blocks: linear probing, no tombstones */
+typedef struct {
+    void *ptr;       /* NULL if the slot is empty */
+    int id;
+} entry_t;
+
+static ring_t rings[MAX_RINGS];
+static volatile int num_rings = 0;      /* high-water mark of the rings used */
+static volatile uint64_t next_seq = 0;  /* sequence numbers handed out */
+static volatile int recording = 0;      /* set up and not exiting */
+static volatile int stopping = 0;       /* tells the writer to finish */
+static pthread_t writer;
+static pthread_key_t ring_key;          /* marks a ring exited with its thread */
+static int out_fd = -1;
+
+static TLS ring_t *my_ring = NULL;
+static TLS int in_recorder = 0;         /* our own requests are not recorded */
+
+/* The state of the writer */
+static entry_t *map;
+static size_t map_mask, map_used;
+static uint64_t next_event = 0;        /* sequence number to replay next */
+static int next_id = 0;
+static int pending[MAX_RINGS];          /* ids of the blocks being realloc'ed */
+static long num_ops = 0;
+static long live_bytes = 0, peak_bytes = 0;
+static long *id_bytes;                  /* size of each live id */
+static int max_ids = 0;
+static char out[OUT_BUFFER];
+static size_t out_len = 0;
+
+/*
+ * release_ring - a thread exits: its ring may go to a new thread once
+ *     the writer has read it
+ */
+static void release_ring(void *ring)
+{
+    __atomic_store_n(&((ring_t *)ring)->state, RING_EXITED, __ATOMIC_RELEASE);
+}
+
+/*
+ * claim_ring - give the calling thread a ring: a free one, or one whose
+ *     thread has exited and whose events have all been read
+ */
+static ring_t *claim_ring(void)
+{
+    int i, state;
+    ring_t *r;
+
+    for (i = 0; i < MAX_RINGS; i++) {
+	r = &rings[i];
+	state = __atomic_load_n(&r->state, __ATOMIC_ACQUIRE);
+	if (state == RING_EXITED &&
+	    __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) != r->tail)
+	    continue;
+	if (state == RING_USED ||
+	    !__atomic_compare_exchange_n(&r->state, &state, RING_USED, 0,
+					 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	    continue;
+	if (r->events == NULL) {
+	    r->events = mmap(NULL, RING_EVENTS * sizeof(event_t), PROT_READ | PROT_WRITE,
+			     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	    if (r->events == MAP_FAILED) {
+		r->events = NULL;
+		return NULL;
+	    }
+	}
+	/* publish the ring to the writer */
+	while ((state = num_rings) <= i &&
+	       !__atomic_compare_exchange_n(&num_rings, &state, i + 1, 0,
+					    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	    ;
+	pthread_setspecific(ring_key, r);
+	return r;
+    }
+    return NULL;
+}
+
+/*
+ * reserve - the ring of the calling thread, once it has room for an
+ *     event, or NULL if the request is not to be recorded
+ */
+static ring_t *reserve(void)
+{
+    ring_t *r;
+
+    if (!recording || in_recorder)
+	return NULL;
+    if ((r = my_ring) == NULL) {
+	in_recorder = 1;
+	r = my_ring = claim_ring();
+	in_recorder = 0;
+	if (r == NULL)
+	    return NULL;
+    }
+    while (r->tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == RING_EVENTS) {
+	if (stopping)
+	    return NULL; /* the writer is gone */
+	sched_yield();
+    }
+    return r;
+}
+
+/*
+ * publish - log an event in a reserved ring, seq being taken by the caller
+ */
+static void publish(ring_t *r, uint64_t seq, int type, void *ptr, size_t size)
+{
+    event_t *e = &r->events[r->tail & (RING_EVENTS - 1)];
+
+    e->seq = seq;
+    e->type = type;
+    e->ptr = ptr;
+    e->size = size;
+    __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * take_seq - the next sequence number
+ */
+static uint64_t take_seq(void)
+{
+    return __atomic_fetch_add(&next_seq, 1, __ATOMIC_ACQ_REL);
+}
+
+/*
+ * flush_out/put - write out the output of the writer, append text to it
+ */
+static void flush_out(void)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < out_len && (n = write(out_fd, out + done, out_len - done)) > 0)
+	done += n;
+    out_len = 0;
+}
+
+static void put(const char *text, size_t len)
+{
+    if (out_len + len > OUT_BUFFER)
+	flush_out();
+    memcpy(out + out_len, text, len);
+    out_len += len;
+}
+
+/*
+ * put_op - write one request of the trace
+ */
+static void put_op(int thread, char type, int id, size_t size)
+{
+    char line[64];
+    int len = 0;
+
+    if (thread != 0)
+	len = sprintf(line, "@%d ", thread);
+    if (type == 'f')
+	len += sprintf(line + len, "f %d\n", id);
+    else
+	len += sprintf(line + len, "%c %d %lu\n", type, id, (unsigned long)size);
+    put(line, len);
+    num_ops++;
+}
+
+/*
+ * map_home - the slot ptr hashes to
+ */
+static size_t map_home(void *ptr)
+{
+    return (((uintptr_t)ptr >> 4) * 0x9E3779B97F4A7C15ULL >> 16) & map_mask;
+}
+
+/*
+ * map_slot - the slot of ptr in the map, or the empty slot where it goes
+ */
+static size_t map_slot(void *ptr)
+{
+    size_t i = map_home(ptr);
+
+    while (map[i].ptr != NULL && map[i].ptr != ptr)
+	i = (i + 1) & map_mask;
+    return i;
+}
+
+/*
+ * map_put/map_take - add a live block, remove one (-1 if unknown)
+ */
+static void map_put(void *ptr, int id)
+{
+    entry_t *old = map;
+    size_t i, old_size = map_mask + 1;
+
+    if (2 * (map_used + 1) > old_size) {
+	map_mask = 2 * old_size - 1;
+	if ((map = (entry_t *)__libc_calloc(map_mask + 1, sizeof(entry_t))) == NULL) {
+	    fprintf(stderr, "mmrecord: out of memory\n");
+	    _exit(1);
+	}
+	for (i = 0; i < old_size; i++)
+	    if (old[i].ptr != NULL)
+		map[map_slot(old[i].ptr)] = old[i];
+	__libc_free(old);
+    }
+    i = map_slot(ptr);
+    map_used += (map[i].ptr == NULL);
+    map[i].ptr = ptr;
+    map[i].id = id;
+}
+
+static int map_take(void *ptr)
+{
+    size_t i = map_slot(ptr), j, home;
+    int id;
+
+    if (map[i].ptr == NULL)
+	return -1;
+    id = map[i].id;
+    map[i].ptr = NULL;
+    map_used--;
+
+    /* shift back the entries that probed past the hole */
+    for (j = (i + 1) & map_mask; map[j].ptr != NULL; j = (j + 1) & map_mask) {
+	home = map_home(map[j].ptr);
+	if (((j - home) & map_mask) >= ((j - i) & map_mask)) {
+	    map[i] = map[j];
+	    map[j].ptr = NULL;
+	    i = j;
+	}
+    }
+    return id;
+}
+
+/*
+ * set_bytes - account the new size of an id, 0 once freed
+ */
+static void set_bytes(int id, size_t size)
+{
+    int old = max_ids;
+
+    if (id >= max_ids) {
+	max_ids = 2 * max_ids + 4096;
+	if ((id_bytes = (long *)__libc_realloc(id_bytes, max_ids * sizeof(long))) == NULL) {
+	    fprintf(stderr, "mmrecord: out of memory\n");
+	    _exit(1);
+	}
+	memset(id_bytes + old, 0, (max_ids - old) * sizeof(long));
+    }
+    live_bytes += (long)size - id_bytes[id];
+    id_bytes[id] = size;
+    if (live_bytes > peak_bytes)
+	peak_bytes = live_bytes;
+}
+
+/*
+ * place_block - give the block at ptr the id, freeing in the trace the
+ *     block libc had there before if its free is still to come: it was
+ *     reused behind our back, between the free and its sequence number
+ */
+static void place_block(int thread, void *ptr, int id)
+{
+    int old;
+
+    if ((old = map_take(ptr)) >= 0) {
+	put_op(thread, 'f', old, 0);
+	set_bytes(old, 0);
+    }
+    map_put(ptr, id);
+}
+
+/*
+ * replay_event - turn an event of a thread into requests of the trace
+ */
+static void replay_event(int thread, event_t *e)
+{
+    int id;
+
+    switch (e->type) {
+    case EV_ALLOC:
+	id = next_id++;
+	place_block(thread, e->ptr, id);
+	set_bytes(id, e->size);
+	put_op(thread, 'a', id, e->size);
+	break;
+    case EV_FREE:
+	if ((id = map_take(e->ptr)) >= 0) {
+	    put_op(thread, 'f', id, 0);
+	    set_bytes(id, 0);
+	}
+	break;
+    case EV_RELEASE:
+	pending[thread] = map_take(e->ptr);
+	break;
+    case EV_REALLOC:
+	id = pending[thread];
+	pending[thread] = -1;
+	if (e->size == 0) {
+	    /* the realloc failed: the block stays where it was */
+	    if (id >= 0)
+		map_put(e->ptr, id);
+	}
+	else if (id < 0) {
+	    /* a block the trace does not know: a new one for the trace */
+	    e->type = EV_ALLOC;
+	    replay_event(thread, e);
+	}
+	else {
+	    place_block(thread, e->ptr, id);
+	    set_bytes(id, e->size);
+	    put_op(thread, 'r', id, e->size);
+	}
+	break;
+    }
+}
+
+/*
+ * drain - replay the events of the rings in sequence order, as far as
+ *     they go without a gap. Returns the number of events replayed.
+ */
+static long drain(void)
+{
+    int i, n;
+    long done = 0;
+    ring_t *r = NULL;
+    event_t *e = NULL;
+
+    while (1) {
+	n = __atomic_load_n(&num_rings, __ATOMIC_ACQUIRE);
+	for (i = 0; i < n; i++) {
+	    r = &rings[i];
+	    if (r->head == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE))
+		continue;
+	    e = &r->events[r->head & (RING_EVENTS - 1)];
+	    if (e->seq == next_event)
+		break;
+	}
+	if (i == n)
+	    return done;
+	replay_event(i, e);
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+	next_event++;
+	done++;
+    }
+}
+
+/*
+ * write_header - the header of the trace, at the start of the file
+ */
+static void write_header(void)
+{
+    char header[4 * (HEADER_WIDTH + 1) + 1];
+
+    sprintf(header, "%*ld\n%*d\n%*ld\n%*d\n", HEADER_WIDTH, peak_bytes,
+	    HEADER_WIDTH, next_id, HEADER_WIDTH, num_ops, HEADER_WIDTH, 1);
+    if (pwrite(out_fd, header, strlen(header), 0) < 0)
+	perror("mmrecord");
+}
+
+/*
+ * writer_main - the writer thread: drain the rings until told to stop
+ */
+static void *writer_main(void *arg)
+{
+    struct timespec nap = {0, WRITER_SLEEP_NS};
+    int i;
+
+    in_recorder = 1;
+    for (i = 0; i < MAX_RINGS; i++)
+	pending[i] = -1;
+    while (!stopping)
+	if (drain() == 0)
+	    nanosleep(&nap, NULL);
+
+    /* the events of the requests that were under way */
+    for (i = 0; i < FINAL_NAPS && next_event != __atomic_load_n(&next_seq, __ATOMIC_ACQUIRE); i++)
+	if (drain() == 0)
+	    nanosleep(&nap, NULL);
+    return NULL;
+}
+
+/*
+ * child_fork - a child does not record into the trace of its parent
+ */
+static void child_fork(void)
+{
+    recording = 0;
+}
+
+__attribute__((constructor))
+static void start_recording(void)
+{
+    char *path = getenv("MM_RECORD");
+    char name[PATH_MAX];
+    char *pid;
+
+    in_recorder = 1;
+    if (path == NULL || *path == '\0')
+	path = DEFAULT_PATH;
+    /* "%p" is the pid, for the processes a program runs */
+    if ((pid = strstr(path, "%p")) != NULL && strlen(path) < PATH_MAX - 16) {
+	sprintf(name, "%.*s%d%s", (int)(pid - path), path, (int)getpid(), pid + 2);
+	path = name;
+    }
+    if ((out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+	perror("mmrecord");
+	in_recorder = 0;
+	return;
+    }
+    map_mask = 1023;
+    if ((map = (entry_t *)__libc_calloc(map_mask + 1, sizeof(entry_t))) == NULL ||
+	pthread_key_create(&ring_key, release_ring) != 0 ||
+	pthread_atfork(NULL, NULL, child_fork) != 0) {
+	fprintf(stderr, "mmrecord: could not set up the recorder\n");
+	in_recorder = 0;
+	return;
+    }
+    write_header();
+    if (lseek(out_fd, 4 * (HEADER_WIDTH + 1), SEEK_SET) < 0 ||
+	pthread_create(&writer, NULL, writer_main, NULL) != 0) {
+	fprintf(stderr, "mmrecord: could not start the writer\n");
+	in_recorder = 0;
+	return;
+    }
+    recording = 1;
+    in_recorder = 0;
+}
+
+__attribute__((destructor))
+static void stop_recording(void)
+{
+    size_t i;
+
+    if (!recording)
+	return;
+    recording = 0;
+    in_recorder = 1;
+    stopping = 1;
+    pthread_join(writer, NULL);
+
+    /* balance the trace */
+    for (i = 0; i <= map_mask; i++)
+	if (map[i].ptr != NULL)
+	    put_op(0, 'f', map[i].id, 0);
+    flush_out();
+    write_header();
+    close(out_fd);
+    fprintf(stderr, "mmrecord: %ld ops, %d ids, peak %ld live bytes\n",
+	    num_ops, next_id, peak_bytes);
+}
+
+/*
+ * record_alloc - log a block libc handed out, under a reserved ring
+ */
+static void *record_alloc(ring_t *r, void *p, size_t size)
+{
+    if (r != NULL && p != NULL)
+	publish(r, take_seq(), EV_ALLOC, p, size ? size : 1);
+    return p;
+}
+
+EXPORT void *malloc(size_t size)
+{
+    ring_t *r = reserve();
+    return record_alloc(r, __libc_malloc(size), size);
+}
+
+EXPORT void *calloc(size_t nmemb, size_t size)
+{
+    ring_t *r = reserve();
+    return record_alloc(r, __libc_calloc(nmemb, size), nmemb * size);
+}
+
+EXPORT void free(void *ptr)
+{
+    ring_t *r;
+
+    if (ptr == NULL)
+	return;
+    if ((r = reserve()) != NULL)
+	publish(r, take_seq(), EV_FREE, ptr, 0);
+    __libc_free(ptr);
+}
+
+EXPORT void *realloc(void *ptr, size_t size)
+{
+    ring_t *r;
+    void *newp;
+
+    if (ptr == NULL)
+	return malloc(size);
+    if (size == 0) {
+	free(ptr);
+	return NULL;
+    }
+    if ((r = reserve()) != NULL)
+	publish(r, take_seq(), EV_RELEASE, ptr, 0);
+    newp = __libc_realloc(ptr, size);
+    if (r != NULL && (r = reserve()) != NULL)
+	publish(r, take_seq(), EV_REALLOC, newp ? newp : ptr, newp ? size : 0);
+    return newp;
+}
+
+EXPORT void *memalign(size_t alignment, size_t size)
+{
+    ring_t *r = reserve();
+    return record_alloc(r, __libc_memalign(alignment, size), size);
+}
+
+EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    ring_t *r;
+    void *p;
+
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+	return EINVAL;
+    r = reserve();
+    if ((p = record_alloc(r, __libc_memalign(alignment, size), size)) == NULL)
+	return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+EXPORT void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
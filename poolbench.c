@@ -0,0 +1,205 @@
+/*
+ * poolbench.c - micro-benchmark of the object pools of mm.c against
+ *     mm_malloc/mm_free on objects of the same size
+ *
+ *     unix> poolbench [-s <size>] [-n <objects>] [-r <rounds>]
+ *
+ * Two access patterns are timed with fsecs, for each allocator:
+ *   batch - take <objects> objects, then give them all back, <rounds> times
+ *   churn - keep <objects> objects live, and replace a random one
+ *           <objects> * <rounds> times
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "fsecs.h"
+
+#define DEFAULT_SIZE 32       /* object size in bytes */
+#define DEFAULT_OBJECTS 1000  /* objects live at once */
+#define DEFAULT_ROUNDS 100    /* repetitions of each pattern */
+
+int verbose = 0; /* read by fsecs.c */
+
+/* Parameters of one measured run */
+typedef struct {
+    int use_pool;     /* mm_pool_get/put if set, else mm_malloc/free */
+    int size;         /* object size in bytes */
+    int objects;      /* objects live at once */
+    int rounds;       /* repetitions */
+    void **live;      /* the live objects */
+    int *victims;     /* precomputed random slots for churn */
+} bench_t;
+
+static void app_error(char *msg);
+static void usage(void);
+
+/*
+ * get_object/put_object - one allocation and one free, with either API
+ */
+static void *get_object(bench_t *b, mm_pool_t *pool)
+{
+    void *p = b->use_pool ? mm_pool_get(pool) : mm_malloc(b->size);
+    if (p == NULL)
+	app_error("allocation failed in poolbench");
+    return p;
+}
+
+static void put_object(bench_t *b, mm_pool_t *pool, void *p)
+{
+    if (b->use_pool)
+	mm_pool_put(pool, p);
+    else
+	mm_free(p);
+}
+
+/*
+ * start_run - reset the heap, and make a pool if the run uses one
+ */
+static mm_pool_t *start_run(bench_t *b)
+{
+    mm_pool_t *pool = NULL;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in poolbench");
+    if (b->use_pool && (pool = mm_pool_create(b->size, 0)) == NULL)
+	app_error("mm_pool_create failed in poolbench");
+    return pool;
+}
+
+/*
+ * bench_batch - take all the objects, then give them all back
+ */
+static void bench_batch(void *ptr)
+{
+    bench_t *b = (bench_t *)ptr;
+    mm_pool_t *pool = start_run(b);
+    int i, r;
+
+    for (r = 0; r < b->rounds; r++) {
+	for (i = 0; i < b->objects; i++)
+	    b->live[i] = get_object(b, pool);
+	for (i = b->objects - 1; i >= 0; i--)
+	    put_object(b, pool, b->live[i]);
+    }
+}
+
+/*
+ * bench_churn - replace random live objects one at a time
+ */
+static void bench_churn(void *ptr)
+{
+    bench_t *b = (bench_t *)ptr;
+    mm_pool_t *pool = start_run(b);
+    int i, r;
+
+    for (i = 0; i < b->objects; i++)
+	b->live[i] = get_object(b, pool);
+    for (r = 0; r < b->rounds; r++) {
+	for (i = 0; i < b->objects; i++) {
+	    int slot = b->victims[i];
+	    put_object(b, pool, b->live[slot]);
+	    b->live[slot] = get_object(b, pool);
+	}
+    }
+    for (i = 0; i < b->objects; i++)
+	put_object(b, pool, b->live[i]);
+}
+
+/*
+ * ns_per_op - time a pattern with one allocator, in ns per get or put
+ */
+static double ns_per_op(fsecs_test_funct f, bench_t *b, int use_pool)
+{
+    double ops = 2.0 * b->objects * b->rounds;
+
+    b->use_pool = use_pool;
+    return fsecs(f, b) * 1e9 / ops;
+}
+
+int main(int argc, char **argv)
+{
+    bench_t b;
+    char c;
+    int i;
+    double pool_ns, mm_ns;
+
+    b.size = DEFAULT_SIZE;
+    b.objects = DEFAULT_OBJECTS;
+    b.rounds = DEFAULT_ROUNDS;
+
+    while ((c = getopt(argc, argv, "hs:n:r:")) != EOF) {
+	switch (c) {
+	case 's':
+	    b.size = atoi(optarg);
+	    break;
+	case 'n':
+	    b.objects = atoi(optarg);
+	    break;
+	case 'r':
+	    b.rounds = atoi(optarg);
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (b.size <= 0 || b.objects <= 0 || b.rounds <= 0) {
+	usage();
+	exit(1);
+    }
+
+    if ((b.live = (void **)malloc(b.objects * sizeof(void *))) == NULL ||
+	(b.victims = (int *)malloc(b.objects * sizeof(int))) == NULL)
+	app_error("malloc failed in poolbench");
+    srand(559);
+    for (i = 0; i < b.objects; i++)
+	b.victims[i] = rand() % b.objects;
+
+    mem_init();
+    init_fsecs();
+
+    printf("%d-byte objects, %d live, %d rounds\n", b.size, b.objects, b.rounds);
+    printf("%8s%14s%14s%10s\n", "pattern", "pool ns/op", "mm ns/op", "speedup");
+
+    pool_ns = ns_per_op(bench_batch, &b, 1);
+    mm_ns = ns_per_op(bench_batch, &b, 0);
+    printf("%8s%14.1f%14.1f%9.1fx\n", "batch", pool_ns, mm_ns, mm_ns / pool_ns);
+
+    pool_ns = ns_per_op(bench_churn, &b, 1);
+    mm_ns = ns_per_op(bench_churn, &b, 0);
+    printf("%8s%14.1f%14.1f%9.1fx\n", "churn", pool_ns, mm_ns, mm_ns / pool_ns);
+
+    mem_deinit();
+    free(b.live);
+    free(b.victims);
+    return 0;
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg)
+{
+    printf("%s\n", msg);
+    exit(1);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: poolbench [-h] [-s <size>] [-n <objects>] [-r <rounds>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h            Print this message.\n");
+    fprintf(stderr, "\t-n <objects>  Objects live at once (default %d).\n", DEFAULT_OBJECTS);
+    fprintf(stderr, "\t-r <rounds>   Repetitions of each pattern (default %d).\n", DEFAULT_ROUNDS);
+    fprintf(stderr, "\t-s <size>     Object size in bytes (default %d).\n", DEFAULT_SIZE);
+}
@@ -0,0 +1,77 @@
+/*
+ * rep2bin.c - convert .rep tracefiles to the binary trace format of
+ *     trace.c, which mdriver maps and decodes instead of parsing
+ *
+ *     unix> rep2bin file.rep file.bin
+ *
+ * The binary trace is read back and compared with the original before
+ * rep2bin reports success.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+int verbose = 0; /* read by trace.c */
+
+/*
+ * same_ops - true if the two traces hold the same requests
+ */
+static int same_ops(trace_t *a, trace_t *b)
+{
+    int i;
+
+    if (a->num_ops != b->num_ops || a->num_ids != b->num_ids ||
+	a->sugg_heapsize != b->sugg_heapsize || a->weight != b->weight ||
+	a->num_threads != b->num_threads)
+	return 0;
+    for (i = 0; i < a->num_ops; i++) {
+	traceop_t *x = &a->ops[i], *y = &b->ops[i];
+	if (x->type != y->type || x->index != y->index || x->thread != y->thread ||
+	    (x->type != FREE && x->size != y->size) ||
+	    ((x->type == REGION_ALLOC || x->type == REGION_RESET) && 
+	     x->region != y->region))
+	    return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    trace_t *trace, *check;
+    FILE *f;
+    long rep_bytes, bin_bytes;
+
+    if (argc != 3) {
+	fprintf(stderr, "Usage: rep2bin <file.rep> <file.bin>\n");
+	exit(1);
+    }
+
+    trace = read_trace("", argv[1]);
+    if (write_trace_bin(trace, argv[2]) < 0) {
+	fprintf(stderr, "rep2bin: could not write %s\n", argv[2]);
+	exit(1);
+    }
+
+    check = read_trace("", argv[2]);
+    if (!same_ops(trace, check)) {
+	fprintf(stderr, "rep2bin: %s does not read back as %s\n", argv[2], argv[1]);
+	exit(1);
+    }
+
+    f = fopen(argv[1], "r");
+    fseek(f, 0, SEEK_END);
+    rep_bytes = ftell(f);
+    fclose(f);
+    f = fopen(argv[2], "r");
+    fseek(f, 0, SEEK_END);
+    bin_bytes = ftell(f);
+    fclose(f);
+    printf("%s: %d ops, %ld bytes -> %s: %ld bytes\n", 
+	   argv[1], trace->num_ops, rep_bytes, argv[2], bin_bytes);
+
+    free_trace(trace);
+    free_trace(check);
+    return 0;
+}
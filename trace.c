@@ -0,0 +1,789 @@
+/*
+ * trace.c - read tracefiles into memory
+ *
+ * A tracefile starts with a header of four numbers (suggested heap
+ * size, number of ids, number of ops, weight), followed by one request
+ * per line: "a id size", "r id size" or "f id".
+ *
+ * Region-tagged traces also use "A id size region", which allocates
+ * block id in a region, and "F region", which releases every block
+ * allocated in the region since its last "F". Region blocks are never
+ * freed or reallocated on their own. Region ids stop below
+ * MAX_TRACE_REGIONS.
+ *
+ * Any request may be tagged with the thread that made it, by a token
+ * "@thread" in front of it: "@1 f 17" frees block 17 from thread 1.
+ * Untagged requests come from thread 0, and tags stop below
+ * MAX_TRACE_THREADS. The order of the file is kept
+ * across the threads, so replaying it on one thread is still valid.
+ *
+ * The same traces can be stored in a binary form (written by rep2bin),
+ * which read_trace recognizes by its magic number and maps instead of
+ * parsing it. All its integers are little-endian:
+ *
+ *   header    "MMTB", version, sugg_heapsize, num_ids, num_ops, weight,
+ *             ops per block, number of blocks, checksum of the block
+ *             table, and the number of threads (10 x 4 bytes)
+ *   table     per block: file offset (8 bytes), size in bytes and
+ *             checksum of its ops (4 bytes each)
+ *   blocks    the ops, BIN_BLOCK_OPS per block (fewer in the last one)
+ *
+ * Each op starts with a varint holding its type in its 3 low bits and,
+ * above them, the zigzag-encoded difference between its id and the id
+ * of the previous op of the block (or the region, for "F"). Sizes and
+ * regions follow as varints, then the thread in version 2, which is only
+ * written for thread-tagged traces. Blocks are independent: the difference
+ * starts from 0 in each, so that they can be decoded one at a time.
+ * Checksums are 32-bit FNV-1a.
+ *
+ * Traces too large to hold in memory are read by chunks of ops with
+ * open_trace_stream/read_trace_stream, which do not link the region
+ * resets to their ids (the ops of a reset keep index = size = 0).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+#define MAXLINE     1024 /* max string size */
+
+#define BIN_MAGIC "MMTB"     /* first bytes of a binary trace */
+#define BIN_VERSION 1        /* untagged traces */
+#define BIN_VERSION_THREADS 2 /* thread-tagged traces */
+#define BIN_BLOCK_OPS 4096   /* ops per block of a binary trace */
+#define BIN_HEADER_SIZE 40
+#define BIN_ENTRY_SIZE 16    /* size of a block table entry */
+#define BIN_MAX_OP 20        /* largest encoded op: 4 varints of 32 bits */
+
+/* Binary trace header, as laid out in the file */
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t sugg_heapsize;
+    uint32_t num_ids;
+    uint32_t num_ops;
+    uint32_t weight;
+    uint32_t block_ops;
+    uint32_t num_blocks;
+    uint32_t checksum;   /* of the block table */
+    uint32_t threads;    /* 0 in version 1 */
+} bin_header_t;
+
+/* Entry of the block table of a binary trace */
+typedef struct {
+    uint64_t offset;     /* from the start of the file */
+    uint32_t bytes;
+    uint32_t checksum;   /* of the encoded ops */
+} bin_block_t;
+
+extern int verbose; /* -v option of the program reading traces */
+
+static char msg[MAXLINE]; /* for whenever we need to compose an error message */
+
+static void link_regions(trace_t *trace, int num_region_ops);
+static void count_peak_live(trace_t *trace);
+static void alloc_trace_arrays(trace_t *trace);
+static trace_t *read_trace_bin(char *path, unsigned char *file, size_t length);
+static int decode_block(unsigned char *p, unsigned char *end, traceop_t *ops, 
+			int count, int tagged, int *num_region_ops);
+static unsigned char *put_varint(unsigned char *p, uint32_t value);
+static uint32_t checksum(unsigned char *p, size_t length);
+static int thread_tag(char *tag);
+
+/* 
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg) 
+{
+    printf("%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+/**********************************************
+ * The following routines manipulate tracefiles
+ *********************************************/
+
+/*
+ * read_trace - read a trace file and store it in memory
+ */
+trace_t *read_trace(char *tracedir, char *filename)
+{
+    FILE *tracefile;
+    trace_t *trace;
+    char type[MAXLINE];
+    char path[MAXLINE];
+    char magic[4];
+    unsigned index, size, region, thread;
+    unsigned max_index = 0;
+    unsigned op_index;
+    int num_region_ops = 0;
+    struct stat st;
+    void *file;
+
+    if (verbose > 1)
+	printf("Reading tracefile: %s\n", filename);
+
+    strcpy(path, tracedir);
+    strcat(path, filename);
+    if ((tracefile = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open %s in read_trace", path);
+	unix_error(msg);
+    }
+
+    /* Binary traces are mapped and decoded, not parsed */
+    if (fread(magic, 1, 4, tracefile) == 4 && 
+	memcmp(magic, BIN_MAGIC, 4) == 0) {
+	if (fstat(fileno(tracefile), &st) < 0 ||
+	    (file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, 
+			 fileno(tracefile), 0)) == MAP_FAILED)
+	    unix_error("mmap failed in read_trace");
+	fclose(tracefile);
+	trace = read_trace_bin(path, (unsigned char *)file, st.st_size);
+	munmap(file, st.st_size);
+	return trace;
+    }
+    rewind(tracefile);
+
+    /* Allocate the trace record */
+    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
+	unix_error("malloc 1 failed in read_trance");
+	
+    /* Read the trace file header */
+    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* mdriver -s */
+    fscanf(tracefile, "%d", &(trace->num_ids));     
+    fscanf(tracefile, "%d", &(trace->num_ops));     
+    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
+    alloc_trace_arrays(trace);
+    
+    /* read every request line in the trace file */
+    index = 0;
+    op_index = 0;
+    while (fscanf(tracefile, "%s", type) != EOF) {
+	thread = 0;
+	if (type[0] == '@') {
+	    if ((thread = thread_tag(type)) == -1) {
+		printf("Bad thread tag (%s) in tracefile %s\n", type, path);
+		exit(1);
+	    }
+	    if (fscanf(tracefile, "%s", type) == EOF)
+		type[0] = '@';
+	    if (thread >= trace->num_threads)
+		trace->num_threads = thread + 1;
+	}
+	trace->ops[op_index].thread = thread;
+	switch(type[0]) {
+	case 'a':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = ALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'r':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = REALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'f':
+	    fscanf(tracefile, "%ud", &index);
+	    trace->ops[op_index].type = FREE;
+	    trace->ops[op_index].index = index;
+	    break;
+	case 'A':
+	    fscanf(tracefile, "%u %u %u", &index, &size, &region);
+	    trace->ops[op_index].type = REGION_ALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    trace->ops[op_index].region = region;
+	    max_index = (index > max_index) ? index : max_index;
+	    if (region >= MAX_TRACE_REGIONS) {
+		printf("Bad region (%u) in tracefile %s\n", region, path);
+		exit(1);
+	    }
+	    if (region >= trace->num_regions)
+		trace->num_regions = region + 1;
+	    num_region_ops++;
+	    break;
+	case 'F':
+	    fscanf(tracefile, "%u", &region);
+	    trace->ops[op_index].type = REGION_RESET;
+	    trace->ops[op_index].region = region;
+	    if (region >= MAX_TRACE_REGIONS) {
+		printf("Bad region (%u) in tracefile %s\n", region, path);
+		exit(1);
+	    }
+	    if (region >= trace->num_regions)
+		trace->num_regions = region + 1;
+	    break;
+	default:
+	    printf("Bogus type character (%c) in tracefile %s\n", 
+		   type[0], path);
+	    exit(1);
+	}
+	op_index++;
+	
+    }
+    fclose(tracefile);
+    assert(max_index == trace->num_ids - 1);
+    assert(trace->num_ops == op_index);
+
+    link_regions(trace, num_region_ops);
+    count_peak_live(trace);
+    
+    return trace;
+}
+
+/* A trace read by chunks */
+struct trace_stream {
+    FILE *file;             /* .rep trace, NULL for a binary one */
+    unsigned char *map;     /* binary trace, mapped */
+    size_t length;
+    bin_header_t header;
+    uint32_t next_block;    /* next block of a binary trace to decode */
+    int ops_left;           /* ops not read yet */
+};
+
+/*
+ * open_trace_stream - open a trace to read its ops by chunks. Only the
+ *     header fields of *header are filled; its arrays stay NULL.
+ */
+trace_stream_t *open_trace_stream(char *tracedir, char *filename, trace_t *header)
+{
+    trace_stream_t *stream;
+    char path[MAXLINE];
+    char magic[4];
+    struct stat st;
+    void *map;
+
+    if ((stream = (trace_stream_t *)calloc(1, sizeof(trace_stream_t))) == NULL)
+	unix_error("malloc failed in open_trace_stream");
+    strcpy(path, tracedir);
+    strcat(path, filename);
+    if ((stream->file = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open %s in open_trace_stream", path);
+	unix_error(msg);
+    }
+    memset(header, 0, sizeof(trace_t));
+
+    if (fread(magic, 1, 4, stream->file) == 4 && 
+	memcmp(magic, BIN_MAGIC, 4) == 0) {
+	if (fstat(fileno(stream->file), &st) < 0 ||
+	    (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, 
+			fileno(stream->file), 0)) == MAP_FAILED)
+	    unix_error("mmap failed in open_trace_stream");
+	fclose(stream->file);
+	stream->file = NULL;
+	stream->map = (unsigned char *)map;
+	stream->length = st.st_size;
+	/* the blocks are read once, in order */
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	if (stream->length < BIN_HEADER_SIZE)
+	    goto corrupt;
+	memcpy(&stream->header, stream->map, BIN_HEADER_SIZE);
+	if ((stream->header.version != BIN_VERSION && 
+	     stream->header.version != BIN_VERSION_THREADS) || stream->header.block_ops == 0 ||
+	    stream->header.threads > MAX_TRACE_THREADS ||
+	    BIN_HEADER_SIZE + (size_t)stream->header.num_blocks * BIN_ENTRY_SIZE > stream->length ||
+	    checksum(stream->map + BIN_HEADER_SIZE, 
+		     (size_t)stream->header.num_blocks * BIN_ENTRY_SIZE) != stream->header.checksum)
+	    goto corrupt;
+	header->sugg_heapsize = stream->header.sugg_heapsize;
+	header->num_ids = stream->header.num_ids;
+	header->num_ops = stream->header.num_ops;
+	header->weight = stream->header.weight;
+	header->num_threads = stream->header.version == BIN_VERSION_THREADS ? 
+	    stream->header.threads : 1;
+    }
+    else {
+	rewind(stream->file);
+	if (fscanf(stream->file, "%d %d %d %d", &header->sugg_heapsize, 
+		   &header->num_ids, &header->num_ops, &header->weight) != 4)
+	    goto corrupt;
+	header->num_threads = 1; /* tags are only known once read */
+    }
+    stream->ops_left = header->num_ops;
+    return stream;
+
+ corrupt:
+    printf("Corrupt tracefile %s\n", path);
+    exit(1);
+}
+
+/*
+ * read_trace_stream - read the next ops of the trace, at most max of
+ *     them (a binary trace gives whole blocks: max must be at least
+ *     BIN_BLOCK_OPS). Returns the number of ops read, 0 at the end.
+ */
+int read_trace_stream(trace_stream_t *stream, traceop_t *ops, int max)
+{
+    bin_block_t block;
+    unsigned index, size, region;
+    char type[MAXLINE];
+    int count = 0, num_region_ops = 0;
+    int tagged = stream->header.version == BIN_VERSION_THREADS;
+
+    if (stream->map != NULL) {
+	while (stream->next_block < stream->header.num_blocks && stream->ops_left > 0 &&
+	       count + (int)stream->header.block_ops <= max) {
+	    int block_count = stream->ops_left;
+	    if (block_count > (int)stream->header.block_ops)
+		block_count = stream->header.block_ops;
+	    memcpy(&block, stream->map + BIN_HEADER_SIZE + 
+		   stream->next_block * BIN_ENTRY_SIZE, BIN_ENTRY_SIZE);
+	    if (block.offset > stream->length || block.bytes > stream->length - block.offset ||
+		checksum(stream->map + block.offset, block.bytes) != block.checksum ||
+		decode_block(stream->map + block.offset, stream->map + block.offset + block.bytes,
+			     ops + count, block_count, tagged, &num_region_ops) < 0) {
+		printf("Corrupt block %u of a binary tracefile\n", stream->next_block);
+		exit(1);
+	    }
+	    count += block_count;
+	    stream->ops_left -= block_count;
+	    stream->next_block++;
+	}
+    }
+    else {
+	while (count < max && stream->ops_left > 0 && 
+	       fscanf(stream->file, "%s", type) != EOF) {
+	    traceop_t *op = &ops[count];
+	    op->index = op->size = op->region = op->thread = 0;
+	    if (type[0] == '@') {
+		if ((op->thread = thread_tag(type)) < 0) {
+		    printf("Bad thread tag (%s) in a tracefile\n", type);
+		    exit(1);
+		}
+		if (fscanf(stream->file, "%s", type) == EOF)
+		    type[0] = '@';
+	    }
+	    switch (type[0]) {
+	    case 'a':
+	    case 'r':
+		fscanf(stream->file, "%u %u", &index, &size);
+		op->type = (type[0] == 'a') ? ALLOC : REALLOC;
+		op->index = index;
+		op->size = size;
+		break;
+	    case 'f':
+		fscanf(stream->file, "%u", &index);
+		op->type = FREE;
+		op->index = index;
+		break;
+	    case 'A':
+		fscanf(stream->file, "%u %u %u", &index, &size, &region);
+		if (region >= MAX_TRACE_REGIONS) {
+		    printf("Bad region (%u) in a tracefile\n", region);
+		    exit(1);
+		}
+		op->type = REGION_ALLOC;
+		op->index = index;
+		op->size = size;
+		op->region = region;
+		break;
+	    case 'F':
+		fscanf(stream->file, "%u", &region);
+		if (region >= MAX_TRACE_REGIONS) {
+		    printf("Bad region (%u) in a tracefile\n", region);
+		    exit(1);
+		}
+		op->type = REGION_RESET;
+		op->region = region;
+		break;
+	    default:
+		printf("Bogus type character (%c) in a tracefile\n", type[0]);
+		exit(1);
+	    }
+	    count++;
+	    stream->ops_left--;
+	}
+    }
+    return count;
+}
+
+/*
+ * close_trace_stream - release a trace opened by open_trace_stream
+ */
+void close_trace_stream(trace_stream_t *stream)
+{
+    if (stream->map != NULL)
+	munmap(stream->map, stream->length);
+    if (stream->file != NULL)
+	fclose(stream->file);
+    free(stream);
+}
+
+/*
+ * alloc_trace_arrays - allocate the ops and the per-id arrays of a
+ *     trace whose header has been read
+ */
+static void alloc_trace_arrays(trace_t *trace)
+{
+    trace->num_regions = 0;
+    trace->num_threads = 1;
+    trace->region_ids = NULL;
+    
+    /* We'll store each request line in the trace in this array */
+    if ((trace->ops = 
+	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	unix_error("malloc 2 failed in read_trace");
+
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in read_trace");
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in read_trace");
+}
+
+/*
+ * read_trace_bin - decode a binary trace mapped at file, block by
+ *     block, checking the checksums on the way
+ */
+static trace_t *read_trace_bin(char *path, unsigned char *file, size_t length)
+{
+    bin_header_t header;
+    bin_block_t block;
+    trace_t *trace;
+    uint32_t b;
+    int num_region_ops = 0, i;
+
+    if (length < BIN_HEADER_SIZE)
+	goto corrupt;
+    memcpy(&header, file, BIN_HEADER_SIZE);
+    if ((header.version != BIN_VERSION && header.version != BIN_VERSION_THREADS) || 
+	header.block_ops == 0 || header.threads > MAX_TRACE_THREADS ||
+	BIN_HEADER_SIZE + (size_t)header.num_blocks * BIN_ENTRY_SIZE > length ||
+	(size_t)header.num_blocks * header.block_ops < header.num_ops ||
+	checksum(file + BIN_HEADER_SIZE, 
+		 (size_t)header.num_blocks * BIN_ENTRY_SIZE) != header.checksum)
+	goto corrupt;
+
+    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
+	unix_error("malloc 1 failed in read_trace_bin");
+    trace->sugg_heapsize = header.sugg_heapsize;
+    trace->num_ids = header.num_ids;
+    trace->num_ops = header.num_ops;
+    trace->weight = header.weight;
+    alloc_trace_arrays(trace);
+    if (header.version == BIN_VERSION_THREADS)
+	trace->num_threads = header.threads;
+
+    for (b = 0; b < header.num_blocks; b++) {
+	int first = b * header.block_ops;
+	int count = trace->num_ops - first;
+	if (count > (int)header.block_ops)
+	    count = header.block_ops;
+
+	memcpy(&block, file + BIN_HEADER_SIZE + b * BIN_ENTRY_SIZE, BIN_ENTRY_SIZE);
+	if (block.offset > length || block.bytes > length - block.offset ||
+	    checksum(file + block.offset, block.bytes) != block.checksum ||
+	    decode_block(file + block.offset, file + block.offset + block.bytes,
+			 trace->ops + first, count, header.version == BIN_VERSION_THREADS,
+			 &num_region_ops) < 0)
+	    goto corrupt;
+    }
+
+    /* region ids only known now */
+    for (i = 0; i < trace->num_ops; i++) {
+	traceop_t *op = &trace->ops[i];
+	if ((op->type == REGION_ALLOC || op->type == REGION_RESET) &&
+	    op->region >= trace->num_regions)
+	    trace->num_regions = op->region + 1;
+	if (op->type != REGION_RESET && (op->index < 0 || op->index >= trace->num_ids))
+	    goto corrupt;
+	if (op->thread < 0 || op->thread >= trace->num_threads)
+	    goto corrupt;
+    }
+
+    link_regions(trace, num_region_ops);
+    count_peak_live(trace);
+    return trace;
+
+ corrupt:
+    printf("Corrupt binary tracefile %s\n", path);
+    exit(1);
+}
+
+/*
+ * get_varint - read a varint (7 bits per byte, low bits first) at *p,
+ *     not beyond end. Returns -1 if it runs past end.
+ */
+static int get_varint(unsigned char **p, unsigned char *end, uint32_t *value)
+{
+    int shift;
+
+    *value = 0;
+    for (shift = 0; shift < 35 && *p < end; shift += 7) {
+	unsigned char byte = *(*p)++;
+	*value |= (uint32_t)(byte & 0x7f) << shift;
+	if ((byte & 0x80) == 0)
+	    return 0;
+    }
+    return -1;
+}
+
+/*
+ * thread_tag - thread of a "@thread" token, or -1 unless it is a
+ *     decimal number below MAX_TRACE_THREADS
+ */
+static int thread_tag(char *tag)
+{
+    char *end;
+    long thread;
+
+    errno = 0;
+    thread = strtol(tag + 1, &end, 10);
+    if (end == tag + 1 || *end != '\0' || errno != 0 || 
+	thread < 0 || thread >= MAX_TRACE_THREADS)
+	return -1;
+    return (int)thread;
+}
+
+/*
+ * decode_block - decode the count ops of the block from p to end into
+ *     ops, each followed by its thread if tagged. Returns -1 if the
+ *     block is malformed. The checksums do not stand against a crafted
+ *     file, so sizes, region ids and threads are range-checked too.
+ */
+static int decode_block(unsigned char *p, unsigned char *end, traceop_t *ops, 
+			int count, int tagged, int *num_region_ops)
+{
+    uint32_t word, size, region, thread = 0;
+    int32_t id = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+	if (get_varint(&p, end, &word) < 0)
+	    return -1;
+	if ((word & 7) != REGION_RESET) {
+	    /* zigzag: the low bit of the difference is its sign */
+	    uint32_t zigzag = word >> 3;
+	    id += (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+	    ops[i].index = id;
+	}
+
+	switch (word & 7) {
+	case ALLOC:
+	case REALLOC:
+	    if (get_varint(&p, end, &size) < 0 || size > INT32_MAX)
+		return -1;
+	    ops[i].type = (word & 7) == ALLOC ? ALLOC : REALLOC;
+	    ops[i].size = size;
+	    break;
+	case FREE:
+	    ops[i].type = FREE;
+	    break;
+	case REGION_ALLOC:
+	    if (get_varint(&p, end, &size) < 0 || size > INT32_MAX ||
+		get_varint(&p, end, &region) < 0 || region >= MAX_TRACE_REGIONS)
+		return -1;
+	    ops[i].type = REGION_ALLOC;
+	    ops[i].size = size;
+	    ops[i].region = region;
+	    (*num_region_ops)++;
+	    break;
+	case REGION_RESET:
+	    if ((word >> 3) >= MAX_TRACE_REGIONS)
+		return -1;
+	    ops[i].type = REGION_RESET;
+	    ops[i].region = word >> 3;
+	    break;
+	default:
+	    return -1;
+	}
+	if (tagged && (get_varint(&p, end, &thread) < 0 || thread >= MAX_TRACE_THREADS))
+	    return -1;
+	ops[i].thread = thread;
+    }
+    return (p == end) ? 0 : -1;
+}
+
+/*
+ * put_varint - write value as a varint at p, return the byte after it
+ */
+static unsigned char *put_varint(unsigned char *p, uint32_t value)
+{
+    while (value >= 0x80) {
+	*p++ = (unsigned char)(value | 0x80);
+	value >>= 7;
+    }
+    *p++ = (unsigned char)value;
+    return p;
+}
+
+/*
+ * checksum - 32-bit FNV-1a of length bytes at p
+ */
+static uint32_t checksum(unsigned char *p, size_t length)
+{
+    uint32_t hash = 2166136261u;
+
+    while (length-- > 0)
+	hash = (hash ^ *p++) * 16777619u;
+    return hash;
+}
+
+/*
+ * write_trace_bin - store a trace read by read_trace in the binary
+ *     format. Returns 0, or -1 if the file could not be written.
+ */
+int write_trace_bin(trace_t *trace, char *path)
+{
+    bin_header_t header;
+    bin_block_t *table;
+    unsigned char *ops, *p;
+    FILE *out;
+    size_t data;
+    uint32_t b;
+    int i, written;
+
+    memcpy(header.magic, BIN_MAGIC, 4);
+    header.version = (trace->num_threads > 1) ? BIN_VERSION_THREADS : BIN_VERSION;
+    header.sugg_heapsize = trace->sugg_heapsize;
+    header.num_ids = trace->num_ids;
+    header.num_ops = trace->num_ops;
+    header.weight = trace->weight;
+    header.block_ops = BIN_BLOCK_OPS;
+    header.num_blocks = (trace->num_ops + BIN_BLOCK_OPS - 1) / BIN_BLOCK_OPS;
+    header.threads = (trace->num_threads > 1) ? trace->num_threads : 0;
+
+    if ((table = (bin_block_t *)calloc(header.num_blocks + 1, BIN_ENTRY_SIZE)) == NULL ||
+	(ops = (unsigned char *)malloc((size_t)trace->num_ops * BIN_MAX_OP + 1)) == NULL)
+	unix_error("malloc failed in write_trace_bin");
+
+    /* encode the blocks one after the other, behind the block table */
+    data = BIN_HEADER_SIZE + (size_t)header.num_blocks * BIN_ENTRY_SIZE;
+    p = ops;
+    for (b = 0; b < header.num_blocks; b++) {
+	unsigned char *start = p;
+	int32_t id = 0;
+	for (i = b * BIN_BLOCK_OPS; i < trace->num_ops && i < (int)(b + 1) * BIN_BLOCK_OPS; i++) {
+	    traceop_t *op = &trace->ops[i];
+	    int32_t delta;
+	    uint32_t zigzag;
+
+	    if (op->type == REGION_RESET)
+		p = put_varint(p, ((uint32_t)op->region << 3) | REGION_RESET);
+	    else {
+		delta = op->index - id;
+		zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+		id = op->index;
+		p = put_varint(p, (zigzag << 3) | op->type);
+		if (op->type != FREE)
+		    p = put_varint(p, op->size);
+		if (op->type == REGION_ALLOC)
+		    p = put_varint(p, op->region);
+	    }
+	    if (header.version == BIN_VERSION_THREADS)
+		p = put_varint(p, op->thread);
+	}
+	table[b].offset = data + (start - ops);
+	table[b].bytes = p - start;
+	table[b].checksum = checksum(start, p - start);
+    }
+    header.checksum = checksum((unsigned char *)table, (size_t)header.num_blocks * BIN_ENTRY_SIZE);
+
+    if ((out = fopen(path, "wb")) == NULL)
+	return -1;
+    written = fwrite(&header, BIN_HEADER_SIZE, 1, out) == 1 &&
+	fwrite(table, BIN_ENTRY_SIZE, header.num_blocks, out) == header.num_blocks &&
+	fwrite(ops, 1, p - ops, out) == (size_t)(p - ops);
+    if (fclose(out) != 0)
+	written = 0;
+    free(table);
+    free(ops);
+    return written ? 0 : -1;
+}
+
+/*
+ * link_regions - list, for each region reset of the trace, the ids of
+ *     the blocks it releases, so that replays do not have to search them
+ */
+static void link_regions(trace_t *trace, int num_region_ops)
+{
+    int *last;   /* per region, last id allocated in it, or -1 */
+    int *prev;   /* per id, id allocated before it in its region */
+    int i, id, count;
+
+    if (trace->num_regions == 0)
+	return;
+
+    if ((trace->region_ids = (int *)malloc((num_region_ops + 1) * sizeof(int))) == NULL ||
+	(last = (int *)malloc(trace->num_regions * sizeof(int))) == NULL ||
+	(prev = (int *)malloc(trace->num_ids * sizeof(int))) == NULL)
+	unix_error("malloc failed in link_regions");
+    for (i = 0; i < trace->num_regions; i++)
+	last[i] = -1;
+
+    count = 0;
+    for (i = 0; i < trace->num_ops; i++) {
+	traceop_t *op = &trace->ops[i];
+	if (op->type == REGION_ALLOC) {
+	    prev[op->index] = last[op->region];
+	    last[op->region] = op->index;
+	}
+	else if (op->type == REGION_RESET) {
+	    op->index = count;
+	    for (id = last[op->region]; id != -1; id = prev[id])
+		trace->region_ids[count++] = id;
+	    op->size = count - op->index;
+	    last[op->region] = -1;
+	}
+    }
+
+    free(last);
+    free(prev);
+}
+
+/*
+ * count_peak_live - find the largest number of blocks live at once
+ */
+static void count_peak_live(trace_t *trace)
+{
+    int i, live = 0;
+
+    trace->peak_live = 0;
+    for (i = 0; i < trace->num_ops; i++) {
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	case REGION_ALLOC:
+	    live++;
+	    break;
+	case FREE:
+	    live--;
+	    break;
+	case REGION_RESET:
+	    live -= trace->ops[i].size;
+	    break;
+	case REALLOC:
+	    break;
+	}
+	if (live > trace->peak_live)
+	    trace->peak_live = live;
+    }
+}
+
+/*
+ * free_trace - Free the trace record and the arrays it points
+ *              to, all of which were allocated in read_trace().
+ */
+void free_trace(trace_t *trace)
+{
+    free(trace->ops);         /* free the arrays...        */
+    free(trace->blocks);      
+    free(trace->block_sizes);
+    free(trace->region_ids);  /* NULL unless region-tagged */
+    free(trace);              /* and the trace record itself... */
+}
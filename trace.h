@@ -0,0 +1,61 @@
+/*
+ * trace.h - in-memory form of the tracefiles (.rep, or binary) replayed by mdriver
+ *           and read by the trace tools
+ */
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+#include <stddef.h>
+
+/* Thread tags of a trace must be below this */
+#define MAX_TRACE_THREADS 256
+
+/* Region ids of a trace must be below this (they index per-region tables) */
+#define MAX_TRACE_REGIONS 65536
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    enum {ALLOC, FREE, REALLOC,
+	  REGION_ALLOC, REGION_RESET} type; /* type of request */
+    int index;   /* index for free() to use later; for a region reset,
+		    offset of the ids it releases in region_ids */
+    int size;    /* byte size of alloc/realloc request; for a region
+		    reset, number of ids it releases */
+    int region;  /* region of a region alloc/reset */
+    int thread;  /* thread that makes the request, 0 if untagged */
+} traceop_t;
+
+/* Holds the information for one trace file*/
+typedef struct {
+    int sugg_heapsize;   /* suggested heap size (mdriver -s) */
+    int num_ids;         /* number of alloc/realloc ids */
+    int num_ops;         /* number of distinct requests */
+    int weight;          /* weight for this trace (unused) */
+    int peak_live;       /* largest number of blocks live at once */
+    int num_regions;     /* number of region ids (0 if no region ops) */
+    int num_threads;     /* number of thread tags (1 if untagged) */
+    int *region_ids;     /* ids released by the region resets */
+    traceop_t *ops;      /* array of requests */
+    char **blocks;       /* array of ptrs returned by malloc/realloc... */
+    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+} trace_t;
+
+/* These functions read, allocate, and free storage for traces */
+trace_t *read_trace(char *tracedir, char *filename);
+void free_trace(trace_t *trace);
+
+/* Stores a trace in the binary format read_trace also accepts */
+int write_trace_bin(trace_t *trace, char *path);
+
+/* 
+ * Reads a trace by chunks of ops, for traces too large to hold: only
+ * the header fields of the trace_t are filled, and the region resets
+ * are not linked to their ids.
+ */
+typedef struct trace_stream trace_stream_t;
+
+trace_stream_t *open_trace_stream(char *tracedir, char *filename, trace_t *header);
+int read_trace_stream(trace_stream_t *stream, traceop_t *ops, int max);
+void close_trace_stream(trace_stream_t *stream);
+
+#endif /* __TRACE_H_ */
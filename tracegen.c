@@ -0,0 +1,629 @@
+/*
+ * tracegen.c - generate synthetic tracefiles from a model of the
+ *     workload, for traces larger or shaped differently than the
+ *     recorded ones
+ *
+ *     unix> tracegen [-s <seed>] [-n <ops>] [-p <peak bytes>] [-d <sizes>]
+ *                    [-l <lifetimes>] [-r <pct>] [-g <pct>] [-P <phases>] file
+ *
+ * The trace is written in the binary format if file ends in ".bin",
+ * as a .rep otherwise. The same options and seed always give the same
+ * trace: the random numbers come from our own generator, not libc's.
+ *
+ * Sizes are drawn from one of
+ *   uniform:min:max          every size in [min, max] alike
+ *   power:min:max:alpha      P(size) ~ size^-alpha over [min, max]
+ *   bimodal:small:large:pct  pct% of large sizes, the others small,
+ *                            each within 25% of its mode
+ *   hist:file                the "size count" lines of file
+ *
+ * Lifetimes follow one of
+ *   lifo                     free the youngest block
+ *   fifo                     free the oldest block
+ *   exp[:mean]               exponential, mean in ops
+ *   pareto[:alpha]           long-tailed: many short, a few very long
+ * lifo and fifo free when the next block would take the live bytes past
+ * the peak; the others free each block when its lifetime ends, their
+ * mean (by default) set for the live bytes to settle near the peak,
+ * and the block due to die first is freed early if they would go past it.
+ *
+ * -r makes pct% of the blocks the start of a realloc chain: pct% of the
+ * ops then grow one of the chained blocks by -g pct% (default 50), up to
+ * its death. -P splits the trace into phases: at the start of each, most
+ * blocks of the previous phase die, and the sizes of the odd phases are
+ * PHASE_SCALE times larger. Every block is freed by the end of the trace.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "trace.h"
+
+#define DEFAULT_OPS 100000       /* requests in the trace */
+#define DEFAULT_PEAK (4 << 20)   /* target of the live bytes */
+#define DEFAULT_GROWTH 50        /* % a realloc chain grows by at each step */
+#define DEFAULT_ALPHA 1.5        /* tail exponent of pareto lifetimes */
+#define MAX_SIZE (1 << 20)       /* largest request, realloc chains included */
+#define MODE_SPREAD 0.25         /* bimodal sizes within 25% of their mode */
+#define PHASE_DEATH 90           /* % of the blocks of a phase dying with it */
+#define PHASE_SCALE 4            /* size factor of the odd phases */
+
+int verbose = 0; /* read by trace.c */
+
+/* Size distributions */
+enum {UNIFORM, POWER, BIMODAL, HISTOGRAM};
+
+/* Lifetime distributions */
+enum {LIFO, FIFO, EXPONENTIAL, PARETO};
+
+/* The model of the workload, from the command line */
+typedef struct {
+    int sizes;          /* size distribution */
+    double min, max;    /* uniform and power: range; bimodal: the modes */
+    double size_alpha;  /* power: exponent */
+    double pct_large;   /* bimodal: % of large sizes */
+    int *hist_sizes;    /* histogram: sizes... */
+    double *hist_cum;   /* ... and their cumulative counts */
+    int hist_len;
+    int lifetimes;      /* lifetime distribution */
+    double mean_life;   /* exponential and pareto: mean in ops, 0 for auto */
+    double life_alpha;  /* pareto: tail exponent */
+    int realloc_pct;    /* % of chained blocks, and of realloc ops */
+    int growth_pct;     /* growth of a realloc chain at each step */
+    int phases;         /* number of phases */
+    int ops;            /* requests in the trace */
+    long peak;          /* target of the live bytes */
+} model_t;
+
+/* A block of the generated trace */
+typedef struct {
+    int size;       /* 0 once freed */
+    int phase;      /* phase it was allocated in */
+    int live_pos;   /* position in the live array */
+} block_t;
+
+/* An id that dies at a time, in the min-heap of deaths */
+typedef struct {
+    double death;
+    int id;
+} death_t;
+
+/* The state of the generator */
+static model_t model;
+static uint64_t rng_state;
+static block_t *blocks;        /* indexed by id */
+static int num_ids, max_ids;
+static int *live, num_live;    /* ids of the live blocks, in no order */
+static int *order, order_lo, order_hi; /* lifo stack, or fifo queue */
+static death_t *deaths;        /* exponential and pareto */
+static int num_deaths;
+static int *chains, num_chains; /* blocks that grow by reallocs */
+static long live_bytes, peak_bytes;
+static traceop_t *ops;
+static int num_ops, max_ops;
+
+static void app_error(char *msg);
+static void usage(void);
+
+/*
+ * next_random - 64 random bits (splitmix64), the same on every platform
+ */
+static uint64_t next_random(void)
+{
+    uint64_t z = (rng_state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/*
+ * uniform - a random number in [0, 1)
+ */
+static double uniform(void)
+{
+    return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * random_below - a random integer in [0, n)
+ */
+static int random_below(int n)
+{
+    return (int)(uniform() * n);
+}
+
+/*
+ * draw_size - a request size from the size distribution of the model
+ */
+static int draw_size(int phase)
+{
+    double u = uniform(), size, mode, a, lo, hi;
+    int l, h, m;
+
+    switch (model.sizes) {
+    case UNIFORM:
+	size = model.min + u * (model.max - model.min + 1);
+	break;
+    case POWER:
+	/* inverse of the distribution function of the truncated power law */
+	a = 1 - model.size_alpha;
+	if (fabs(a) < 1e-9)
+	    size = model.min * pow(model.max / model.min, u);
+	else {
+	    lo = pow(model.min, a);
+	    hi = pow(model.max, a);
+	    size = pow(lo + u * (hi - lo), 1 / a);
+	}
+	break;
+    case BIMODAL:
+	mode = (100 * u < model.pct_large) ? model.max : model.min;
+	size = mode * (1 - MODE_SPREAD + 2 * MODE_SPREAD * uniform());
+	break;
+    default:
+	/* first size whose cumulative count passes u */
+	u *= model.hist_cum[model.hist_len - 1];
+	for (l = 0, h = model.hist_len - 1; l < h; ) {
+	    m = (l + h) / 2;
+	    if (model.hist_cum[m] > u)
+		h = m;
+	    else
+		l = m + 1;
+	}
+	size = model.hist_sizes[l];
+	break;
+    }
+    if (phase % 2 == 1)
+	size *= PHASE_SCALE;
+    if (size < 1)
+	size = 1;
+    return (size > MAX_SIZE) ? MAX_SIZE : (int)size;
+}
+
+/*
+ * draw_lifetime - the lifetime in ops of a new block, for exponential
+ *     and pareto lifetimes
+ */
+static double draw_lifetime(void)
+{
+    double u = 1 - uniform(); /* in (0, 1] */
+    double xm;
+
+    if (model.lifetimes == EXPONENTIAL)
+	return -model.mean_life * log(u);
+    xm = model.mean_life * (model.life_alpha - 1) / model.life_alpha;
+    return xm / pow(u, 1 / model.life_alpha);
+}
+
+/*
+ * add_op - append a request to the trace
+ */
+static void add_op(int type, int id, int size)
+{
+    if (num_ops == max_ops) {
+	max_ops = 2 * max_ops + 1024;
+	if ((ops = (traceop_t *)realloc(ops, max_ops * sizeof(traceop_t))) == NULL)
+	    app_error("tracegen: out of memory");
+    }
+    memset(&ops[num_ops], 0, sizeof(traceop_t));
+    ops[num_ops].type = type;
+    ops[num_ops].index = id;
+    ops[num_ops].size = size;
+    num_ops++;
+}
+
+/*
+ * push_death/pop_death - the min-heap of the deaths to come
+ */
+static void push_death(double death, int id)
+{
+    int i = num_deaths++;
+
+    while (i > 0 && deaths[(i - 1) / 2].death > death) {
+	deaths[i] = deaths[(i - 1) / 2];
+	i = (i - 1) / 2;
+    }
+    deaths[i].death = death;
+    deaths[i].id = id;
+}
+
+static death_t pop_death(void)
+{
+    death_t top = deaths[0], last = deaths[--num_deaths];
+    int i = 0, child;
+
+    while ((child = 2 * i + 1) < num_deaths) {
+	if (child + 1 < num_deaths && deaths[child + 1].death < deaths[child].death)
+	    child++;
+	if (deaths[child].death >= last.death)
+	    break;
+	deaths[i] = deaths[child];
+	i = child;
+    }
+    deaths[i] = last;
+    return top;
+}
+
+/*
+ * alloc_block - allocate a new block of the given size
+ */
+static void alloc_block(int size, int phase)
+{
+    int id = num_ids++;
+
+    if (id == max_ids)
+	app_error("tracegen: too many ids");
+    blocks[id].size = size;
+    blocks[id].phase = phase;
+    blocks[id].live_pos = num_live;
+    live[num_live++] = id;
+    live_bytes += size;
+    if (live_bytes > peak_bytes)
+	peak_bytes = live_bytes;
+    add_op(ALLOC, id, size);
+
+    if (model.lifetimes == LIFO || model.lifetimes == FIFO)
+	order[order_hi++] = id;
+    else
+	push_death(num_ops + draw_lifetime(), id);
+    if (model.realloc_pct > 0 && 100 * uniform() < model.realloc_pct)
+	chains[num_chains++] = id;
+}
+
+/*
+ * free_block - free a live block. The lifo, fifo, deaths and chains
+ *     structures may still hold its id: they skip the freed ones.
+ */
+static void free_block(int id)
+{
+    int last = live[--num_live];
+
+    live[blocks[id].live_pos] = last;
+    blocks[last].live_pos = blocks[id].live_pos;
+    live_bytes -= blocks[id].size;
+    blocks[id].size = 0;
+    add_op(FREE, id, 0);
+}
+
+/*
+ * free_next - free the block the lifetime model picks next: the
+ *     youngest, the oldest, or the first to die. Returns 0 if none is left.
+ */
+static int free_next(void)
+{
+    int id;
+
+    while (1) {
+	if (model.lifetimes == LIFO && order_hi > order_lo)
+	    id = order[--order_hi];
+	else if (model.lifetimes == FIFO && order_hi > order_lo)
+	    id = order[order_lo++];
+	else if (model.lifetimes != LIFO && model.lifetimes != FIFO && num_deaths > 0)
+	    id = pop_death().id;
+	else
+	    return 0;
+	if (blocks[id].size > 0) {
+	    free_block(id);
+	    return 1;
+	}
+    }
+}
+
+/*
+ * grow_chain - grow a random block of the realloc chains, or free a
+ *     block if the growth would pass the peak. Returns 0 if no chained
+ *     block is live.
+ */
+static int grow_chain(void)
+{
+    int i, id;
+    long size;
+
+    while (num_chains > 0) {
+	i = random_below(num_chains);
+	id = chains[i];
+	if (blocks[id].size == 0 || blocks[id].size == MAX_SIZE) {
+	    chains[i] = chains[--num_chains];
+	    continue;
+	}
+	size = blocks[id].size + (long)blocks[id].size * model.growth_pct / 100 + 1;
+	if (size > MAX_SIZE)
+	    size = MAX_SIZE;
+	if (live_bytes + size - blocks[id].size > model.peak && free_next())
+	    return 1; /* make room first */
+	live_bytes += size - blocks[id].size;
+	if (live_bytes > peak_bytes)
+	    peak_bytes = live_bytes;
+	blocks[id].size = size;
+	add_op(REALLOC, id, size);
+	return 1;
+    }
+    return 0;
+}
+
+/*
+ * end_phase - the blocks of a phase mostly die with it
+ */
+static void end_phase(int phase)
+{
+    int i;
+
+    for (i = 0; i < num_live; ) {
+	int id = live[i];
+	if (blocks[id].phase == phase && 100 * uniform() < PHASE_DEATH)
+	    free_block(id); /* moves the last live block to i */
+	else
+	    i++;
+    }
+}
+
+/*
+ * generate - generate the requests of the trace
+ */
+static void generate(void)
+{
+    int phase = 0, size;
+    double mean_size = 0, alloc_rate, fill;
+
+    max_ids = model.ops;
+    if ((blocks = (block_t *)malloc(max_ids * sizeof(block_t))) == NULL ||
+	(live = (int *)malloc(max_ids * sizeof(int))) == NULL ||
+	(order = (int *)malloc(max_ids * sizeof(int))) == NULL ||
+	(deaths = (death_t *)malloc(max_ids * sizeof(death_t))) == NULL ||
+	(chains = (int *)malloc(max_ids * sizeof(int))) == NULL)
+	app_error("tracegen: out of memory");
+
+    /*
+     * By Little's law, the mean lifetime that keeps the peak live: the
+     * bytes allocated per op times the lifetime. Each block takes an
+     * alloc and a free, and the reallocs take their share of the ops,
+     * so the allocations are only about half of them.
+     */
+    if (model.mean_life == 0) {
+	for (size = 0; size < 1000; size++)
+	    mean_size += draw_size(0) / 1000.0;
+	alloc_rate = (100 - model.realloc_pct) / 200.0;
+	model.mean_life = model.peak / (alloc_rate * mean_size);
+    }
+
+    while (num_ops + num_live < model.ops) {
+	if (model.phases > 1 &&
+	    num_ops >= (long)(phase + 1) * model.ops / model.phases) {
+	    end_phase(phase);
+	    phase++;
+	    continue;
+	}
+
+	/* deaths that are due */
+	if (model.lifetimes != LIFO && model.lifetimes != FIFO &&
+	    num_deaths > 0 && deaths[0].death <= num_ops) {
+	    free_next();
+	    continue;
+	}
+
+	if (model.realloc_pct > 0 && 100 * uniform() < model.realloc_pct && grow_chain())
+	    continue;
+
+	/* lifo and fifo ramp up to the peak, then hover below it */
+	size = draw_size(phase);
+	fill = (double)live_bytes / model.peak;
+	if (live_bytes + size > model.peak ||
+	    ((model.lifetimes == LIFO || model.lifetimes == FIFO) &&
+	     uniform() < 0.5 * fill)) {
+	    if (free_next())
+		continue;
+	}
+	alloc_block(size, phase);
+    }
+
+    /* a balanced trace: everything is freed */
+    while (num_live > 0)
+	free_block(live[num_live - 1]);
+}
+
+/*
+ * parse_sizes - parse the -d argument
+ */
+static void parse_sizes(char *spec)
+{
+    FILE *f;
+    int size, max_len = 0;
+    double count;
+
+    if (sscanf(spec, "uniform:%lf:%lf", &model.min, &model.max) == 2)
+	model.sizes = UNIFORM;
+    else if (sscanf(spec, "power:%lf:%lf:%lf", &model.min, &model.max, &model.size_alpha) == 3)
+	model.sizes = POWER;
+    else if (sscanf(spec, "bimodal:%lf:%lf:%lf", &model.min, &model.max, &model.pct_large) == 3)
+	model.sizes = BIMODAL;
+    else if (strncmp(spec, "hist:", 5) == 0) {
+	model.sizes = HISTOGRAM;
+	if ((f = fopen(spec + 5, "r")) == NULL)
+	    app_error("tracegen: could not open the size histogram");
+	while (fscanf(f, "%d %lf", &size, &count) == 2) {
+	    if (size <= 0 || count < 0)
+		continue;
+	    if (model.hist_len == max_len) {
+		max_len = 2 * max_len + 64;
+		model.hist_sizes = (int *)realloc(model.hist_sizes, max_len * sizeof(int));
+		model.hist_cum = (double *)realloc(model.hist_cum, max_len * sizeof(double));
+		if (model.hist_sizes == NULL || model.hist_cum == NULL)
+		    app_error("tracegen: out of memory");
+	    }
+	    model.hist_sizes[model.hist_len] = size;
+	    model.hist_cum[model.hist_len] = count +
+		(model.hist_len ? model.hist_cum[model.hist_len - 1] : 0);
+	    model.hist_len++;
+	}
+	fclose(f);
+	if (model.hist_len == 0 || model.hist_cum[model.hist_len - 1] <= 0)
+	    app_error("tracegen: empty size histogram");
+	return;
+    }
+    else {
+	usage();
+	exit(1);
+    }
+    if (model.min < 1 || model.max < model.min || model.max > MAX_SIZE ||
+	(model.sizes == POWER && model.size_alpha <= 0) ||
+	(model.sizes == BIMODAL && (model.pct_large < 0 || model.pct_large > 100))) {
+	usage();
+	exit(1);
+    }
+}
+
+/*
+ * parse_lifetimes - parse the -l argument
+ */
+static void parse_lifetimes(char *spec)
+{
+    if (strcmp(spec, "lifo") == 0)
+	model.lifetimes = LIFO;
+    else if (strcmp(spec, "fifo") == 0)
+	model.lifetimes = FIFO;
+    else if (strncmp(spec, "exp", 3) == 0 && (spec[3] == '\0' || spec[3] == ':')) {
+	model.lifetimes = EXPONENTIAL;
+	if (spec[3] == ':')
+	    model.mean_life = atof(spec + 4);
+    }
+    else if (strncmp(spec, "pareto", 6) == 0 && (spec[6] == '\0' || spec[6] == ':')) {
+	model.lifetimes = PARETO;
+	if (spec[6] == ':')
+	    model.life_alpha = atof(spec + 7);
+    }
+    else {
+	usage();
+	exit(1);
+    }
+    if (model.mean_life < 0 || (model.lifetimes == PARETO && model.life_alpha <= 1)) {
+	usage();
+	exit(1);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    char c;
+    char *path, *sizes = "power:8:4096:1.5", *lifetimes = "exp";
+    uint64_t seed = 1;
+    trace_t trace;
+    FILE *out;
+    size_t len;
+    int i, written;
+
+    model.ops = DEFAULT_OPS;
+    model.peak = DEFAULT_PEAK;
+    model.growth_pct = DEFAULT_GROWTH;
+    model.life_alpha = DEFAULT_ALPHA;
+    model.phases = 1;
+
+    while ((c = getopt(argc, argv, "hs:n:p:d:l:r:g:P:")) != EOF) {
+	switch (c) {
+	case 's':
+	    seed = strtoull(optarg, NULL, 0);
+	    break;
+	case 'n':
+	    model.ops = atoi(optarg);
+	    break;
+	case 'p':
+	    model.peak = atol(optarg);
+	    break;
+	case 'd':
+	    sizes = optarg;
+	    break;
+	case 'l':
+	    lifetimes = optarg;
+	    break;
+	case 'r':
+	    model.realloc_pct = atoi(optarg);
+	    break;
+	case 'g':
+	    model.growth_pct = atoi(optarg);
+	    break;
+	case 'P':
+	    model.phases = atoi(optarg);
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (optind != argc - 1 || model.ops < 2 || model.peak <= 0 || model.phases < 1 ||
+	model.realloc_pct < 0 || model.realloc_pct > 100 || model.growth_pct <= 0) {
+	usage();
+	exit(1);
+    }
+    path = argv[optind];
+    parse_lifetimes(lifetimes);
+    parse_sizes(sizes);
+
+    rng_state = seed;
+    generate();
+
+    memset(&trace, 0, sizeof(trace));
+    trace.sugg_heapsize = peak_bytes;
+    trace.num_ids = num_ids;
+    trace.num_ops = num_ops;
+    trace.weight = 1;
+    trace.num_threads = 1;
+    trace.ops = ops;
+
+    len = strlen(path);
+    if (len > 4 && strcmp(path + len - 4, ".bin") == 0)
+	written = (write_trace_bin(&trace, path) == 0);
+    else {
+	if ((out = fopen(path, "w")) == NULL)
+	    app_error("tracegen: could not open the output file");
+	fprintf(out, "%d\n%d\n%d\n%d\n", trace.sugg_heapsize, trace.num_ids,
+		trace.num_ops, trace.weight);
+	for (i = 0; i < num_ops; i++) {
+	    if (ops[i].type == ALLOC)
+		fprintf(out, "a %d %d\n", ops[i].index, ops[i].size);
+	    else if (ops[i].type == REALLOC)
+		fprintf(out, "r %d %d\n", ops[i].index, ops[i].size);
+	    else
+		fprintf(out, "f %d\n", ops[i].index);
+	}
+	written = (fclose(out) == 0);
+    }
+    if (!written)
+	app_error("tracegen: could not write the trace");
+
+    printf("%s: %d ops, %d ids, peak %ld live bytes\n", path, num_ops, num_ids, peak_bytes);
+    return 0;
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg)
+{
+    printf("%s\n", msg);
+    exit(1);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracegen [-h] [-s <seed>] [-n <ops>] [-p <peak bytes>] [-d <sizes>]\n");
+    fprintf(stderr, "                [-l <lifetimes>] [-r <pct>] [-g <pct>] [-P <phases>] <file>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-d <sizes>      uniform:min:max, power:min:max:alpha,\n");
+    fprintf(stderr, "\t                bimodal:small:large:pct or hist:file (default power:8:4096:1.5).\n");
+    fprintf(stderr, "\t-g <pct>        Growth of each realloc of a chain (default %d).\n", DEFAULT_GROWTH);
+    fprintf(stderr, "\t-h              Print this message.\n");
+    fprintf(stderr, "\t-l <lifetimes>  lifo, fifo, exp[:mean ops] or pareto[:alpha] (default exp).\n");
+    fprintf(stderr, "\t-n <ops>        Requests in the trace (default %d).\n", DEFAULT_OPS);
+    fprintf(stderr, "\t-p <bytes>      Target of the live bytes (default %d).\n", DEFAULT_PEAK);
+    fprintf(stderr, "\t-P <phases>     Number of phases (default 1).\n");
+    fprintf(stderr, "\t-r <pct>        Blocks starting realloc chains, and realloc ops (default 0).\n");
+    fprintf(stderr, "\t-s <seed>       Seed of the random numbers (default 1).\n");
+    fprintf(stderr, "\t<file>          Output, in the binary format if it ends in .bin.\n");
+}